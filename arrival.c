@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "arrival.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool arrival_parse(struct arrival_config *config, const char *spec) {
+	char *s = strdup(spec);
+	char *name = strtok(s, ":");
+	char *rate = strtok(NULL, ":");
+	char *period = strtok(NULL, ":");
+	char *duty = strtok(NULL, "");
+	bool ok = name != NULL && rate != NULL;
+	if (!ok) goto out;
+
+	config->rate = atof(rate);
+	config->period_ns = 0;
+	config->duty = 1;
+	if (!strcmp(name, "const")) {
+		config->process = ARRIVAL_CONSTANT;
+		ok = period == NULL;
+	} else if (!strcmp(name, "poisson")) {
+		config->process = ARRIVAL_POISSON;
+		ok = period == NULL;
+	} else if (!strcmp(name, "onoff")) {
+		config->process = ARRIVAL_ONOFF;
+		ok = period != NULL && duty != NULL;
+		if (ok) {
+			config->period_ns = atof(period) * 1e6;
+			config->duty = atof(duty) / 100;
+			ok = config->period_ns > 0 && config->duty > 0 && config->duty <= 1;
+		}
+	} else {
+		ok = false;
+	}
+	ok = ok && config->rate > 0;
+out:
+	free(s);
+	return ok;
+}
+
+void arrival_print(const struct arrival_config *config) {
+	switch (config->process) {
+	case ARRIVAL_NONE:
+		break;
+	case ARRIVAL_CONSTANT:
+		printf("Arrivals: constant, %.0f commands/s\n", config->rate);
+		break;
+	case ARRIVAL_POISSON:
+		printf("Arrivals: Poisson, %.0f commands/s\n", config->rate);
+		break;
+	case ARRIVAL_ONOFF:
+		printf("Arrivals: on/off, %.0f commands/s for %.0f%% of %.1f ms\n", config->rate, config->duty * 100, config->period_ns / 1e6);
+		break;
+	}
+}
+
+void arrival_init(struct arrival *a, const struct arrival_config *config, int worker, int workers, uint64_t start) {
+	a->config = config;
+	a->start = start;
+	a->interval_ns = 1e9 * workers / config->rate;
+	rng_seed(&a->rng, worker);
+	if (config->process == ARRIVAL_POISSON)
+		a->active_ns = -log(1 - rng_double(&a->rng)) * a->interval_ns;
+	else
+		// Interleave the workers' constant schedules.
+		a->active_ns = a->interval_ns * worker / workers;
+}
+
+uint64_t arrival_next(struct arrival *a) {
+	const struct arrival_config *c = a->config;
+	double active = a->active_ns;
+	if (c->process == ARRIVAL_POISSON)
+		// Exponentially distributed gaps, 1 - x avoids log(0).
+		a->active_ns += -log(1 - rng_double(&a->rng)) * a->interval_ns;
+	else
+		a->active_ns += a->interval_ns;
+
+	if (c->process != ARRIVAL_ONOFF)
+		return a->start + active;
+	// Map active time into the on phases.
+	double on_ns = c->period_ns * c->duty;
+	double cycles = floor(active / on_ns);
+	return a->start + cycles * c->period_ns + (active - cycles * on_ns);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "random.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Open-loop load: commands are released on a schedule that is independent of
+// how fast the device completes them.
+enum arrival_process {
+	ARRIVAL_NONE = 0,
+	ARRIVAL_CONSTANT,
+	ARRIVAL_POISSON,
+	ARRIVAL_ONOFF,
+};
+
+struct arrival_config {
+	enum arrival_process process;
+	// Commands per second over all workers while active.
+	double rate;
+	// On/off cycle, commands are only released in the first `duty` part.
+	uint64_t period_ns;
+	double duty;
+};
+
+// Per-worker schedule.
+struct arrival {
+	const struct arrival_config *config;
+	uint64_t start;
+	// Active time of the next command in ns since start.
+	double active_ns;
+	// Mean time between this worker's commands.
+	double interval_ns;
+	struct rng rng;
+};
+
+// Parses an arrival process specification for -A. Returns false on errors.
+bool arrival_parse(struct arrival_config *config, const char *spec);
+// Prints the arrival process to stdout.
+void arrival_print(const struct arrival_config *config);
+
+// Sets up the schedule of worker number `worker` out of `workers`, starting at `start`.
+void arrival_init(struct arrival *a, const struct arrival_config *config, int worker, int workers, uint64_t start);
+// Returns the time at which the next command is due.
+uint64_t arrival_next(struct arrival *a);
@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For O_DIRECT.
+#define _GNU_SOURCE
+
+#include "backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+static const struct io_backend *backends[] = {
+	&nvme_backend,
+	&uring_backend,
+	&file_backend,
+	&sim_backend,
+	NULL
+};
+
+const struct io_backend * backend_find(const char *name) {
+	for (const struct io_backend **b = backends; *b; b++)
+		if (!strcmp((*b)->name, name)) return *b;
+	return NULL;
+}
+
+void backend_print_list() {
+	for (const struct io_backend **b = backends; *b; b++)
+		fprintf(stderr, "\t\t%s\t%s\n", (*b)->name, (*b)->desc);
+}
+
+void backend_generic_identify(int fd, struct ssd_features *features) {
+	struct stat st;
+	if (fstat(fd, &st) < 0) goto perror;
+
+	snprintf(features->sn, sizeof(features->sn), "n/a");
+	snprintf(features->mn, sizeof(features->mn), "%s", S_ISREG(st.st_mode) ? "Regular file" : "Generic block device");
+	if (S_ISBLK(st.st_mode)) {
+		uint64_t size;
+		int block_size;
+		if (ioctl(fd, BLKGETSIZE64, &size) < 0 || ioctl(fd, BLKSSZGET, &block_size) < 0)
+			goto perror;
+		features->lba_shift = __builtin_ctz(block_size);
+		features->size = size >> features->lba_shift;
+	} else {
+		// 4 KiB blocks work with O_DIRECT on all common file systems.
+		features->lba_shift = 12;
+		features->size = st.st_size >> features->lba_shift;
+	}
+	// Without MDTS, use a common maximum transfer size of 128 KiB.
+	features->max_block_count = (128 << 10) >> features->lba_shift;
+	return;
+perror:
+	perror("identify");
+	exit(1);
+}
+
+int backend_open_direct(const char *path) {
+	// O_DIRECT isn't supported everywhere (e.g. tmpfs).
+	int fd = open(path, O_RDWR | O_DIRECT);
+	if (fd < 0 && errno == EINVAL)
+		fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		exit(errno);
+	}
+	return fd;
+}
+
+struct sync_completions * sync_completions_create(unsigned depth) {
+	struct sync_completions *c = malloc(sizeof(*c) + depth * sizeof(c->user_data[0]));
+	c->count = 0;
+	c->size = depth;
+	return c;
+}
+
+void sync_completions_add(struct sync_completions *c, uint64_t user_data) {
+	if (c->count == c->size) {
+		fprintf(stderr, "Too many commands in flight.\n");
+		exit(1);
+	}
+	c->user_data[c->count++] = user_data;
+}
+
+unsigned sync_completions_poll(struct sync_completions *c, uint64_t *user_data, unsigned max) {
+	unsigned n = MIN(c->count, max);
+	c->count -= n;
+	memcpy(user_data, c->user_data + c->count, n * sizeof(*user_data));
+	return n;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pattern.h"
+
+struct io_request {
+	// Operation, see OP_* in pattern.h.
+	int op;
+	void *buffer;
+	uint64_t start_block;
+	// 0-based like the NVMe block count, i.e. transfers block_count + 1 blocks.
+	uint16_t block_count;
+	// Returned on completion.
+	uint64_t user_data;
+};
+
+// A way of getting commands to a device. Device and queue handles are
+// private to the backend.
+struct io_backend {
+	const char *name;
+	const char *desc;
+
+	// Opens a device. `options` is the part after the colon of -e or NULL.
+	// Exits on failure.
+	void * (*open)(const char *path, const char *options);
+	// Fills in the device features.
+	void (*identify)(void *dev, struct ssd_features *features);
+	// Returns the queue depth to use without -q. Optional, defaults to 1.
+	unsigned (*default_depth)(void *dev);
+
+	// Creates submission state for the calling thread with room for `depth`
+	// commands in flight.
+	void * (*create_queue)(void *dev, unsigned depth);
+	void (*destroy_queue)(void *queue);
+
+	// Queues a command. Synchronous backends execute it right away.
+	void (*submit)(void *queue, const struct io_request *req);
+	// Pushes queued commands to the device without waiting.
+	void (*flush)(void *queue);
+	// Flushes and waits for at least `min` completions. Stores the user_data
+	// of up to `max` completed commands and returns their number.
+	unsigned (*poll)(void *queue, uint64_t *user_data, unsigned min, unsigned max);
+};
+
+extern const struct io_backend nvme_backend, uring_backend, file_backend, sim_backend;
+
+// Returns the backend called `name` or NULL.
+const struct io_backend * backend_find(const char *name);
+// Prints the list of backends for usage messages.
+void backend_print_list();
+
+// Fills in features for block devices and regular files without NVMe identify.
+void backend_generic_identify(int fd, struct ssd_features *features);
+// Opens a block device or file for reads and writes, with O_DIRECT if possible.
+int backend_open_direct(const char *path);
+
+// Helper for synchronous backends: completions are available right after
+// submission and are kept in a simple array.
+struct sync_completions {
+	unsigned count, size;
+	uint64_t user_data[];
+};
+struct sync_completions * sync_completions_create(unsigned depth);
+void sync_completions_add(struct sync_completions *c, uint64_t user_data);
+unsigned sync_completions_poll(struct sync_completions *c, uint64_t *user_data, unsigned max);
@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For MAP_HUGETLB.
+#define _GNU_SOURCE
+
+#include "buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "numa.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+
+#define HUGE_2M (2ul << 20)
+#define HUGE_1G (1ul << 30)
+
+static bool is(const char *arg, size_t len, const char *name) {
+	return len == strlen(name) && !strncmp(arg, name, len);
+}
+
+bool buffer_parse(const char *arg, struct buffer_config *config) {
+	size_t len = strcspn(arg, ":");
+	if (is(arg, len, "4k"))
+		config->pages = BUFFER_PAGES_SMALL;
+	else if (is(arg, len, "thp"))
+		config->pages = BUFFER_PAGES_THP;
+	else if (is(arg, len, "2m"))
+		config->pages = BUFFER_PAGES_2M;
+	else if (is(arg, len, "1g"))
+		config->pages = BUFFER_PAGES_1G;
+	else
+		goto invalid;
+	config->lock = false;
+	if (arg[len] == '\0') return true;
+	if (!strcmp(arg + len, ":lock")) {
+		config->lock = true;
+		return true;
+	}
+invalid:
+	fprintf(stderr, "Invalid buffer pages: %s\n", arg);
+	return false;
+}
+
+const char *buffer_page_desc(const struct buffer_config *config) {
+	switch (config->pages) {
+	case BUFFER_PAGES_THP: return "transparent huge pages";
+	case BUFFER_PAGES_2M:  return "2 MiB pages";
+	case BUFFER_PAGES_1G:  return "1 GiB pages";
+	default:               return "4 KiB pages";
+	}
+}
+
+void *buffer_alloc(size_t size, const struct buffer_config *config) {
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	size_t page = sysconf(_SC_PAGESIZE);
+	switch (config->pages) {
+	case BUFFER_PAGES_SMALL:
+		break;
+	case BUFFER_PAGES_THP:
+		page = HUGE_2M;
+		break;
+	case BUFFER_PAGES_2M:
+		page = HUGE_2M;
+		flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+		break;
+	case BUFFER_PAGES_1G:
+		page = HUGE_1G;
+		flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+		break;
+	}
+	// Patterns like flush don't need a buffer, but mmap rejects empty ones.
+	if (size == 0) size = page;
+	size = (size + page - 1) & ~(page - 1);
+
+	uint8_t *buffer;
+	if (config->pages == BUFFER_PAGES_THP) {
+		// Over-allocate so that the buffer can start on a huge page boundary.
+		uint8_t *area = mmap(NULL, size + page, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (area == MAP_FAILED) goto perror;
+		buffer = (uint8_t *) (((uintptr_t) area + page - 1) & ~(page - 1));
+		if (buffer > area) munmap(area, buffer - area);
+		munmap(buffer + size, area + page - buffer);
+		if (madvise(buffer, size, MADV_HUGEPAGE) < 0) goto perror;
+	} else {
+		buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (buffer == MAP_FAILED) {
+			if (flags & MAP_HUGETLB)
+				fprintf(stderr, "Could not allocate %zu MiB of %s, check /sys/kernel/mm/hugepages.\n",
+						size >> 20, buffer_page_desc(config));
+			goto perror;
+		}
+	}
+
+	// The memory policy has to be in place before the pages are first touched.
+	numa_bind_memory(buffer, size);
+	// Writing (instead of reading) makes sure we don't just map the zero page.
+	// Touch every small page in case we didn't get huge ones.
+	size_t small_page = sysconf(_SC_PAGESIZE);
+	for (size_t off = 0; off < size; off += small_page)
+		buffer[off] = 0;
+	if (config->lock && mlock(buffer, size) < 0) {
+		perror("mlock");
+		exit(1);
+	}
+	return buffer;
+perror:
+	perror("mmap");
+	exit(1);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Pages backing the memory buffer.
+enum buffer_pages {
+	BUFFER_PAGES_SMALL,
+	BUFFER_PAGES_THP,
+	BUFFER_PAGES_2M,
+	BUFFER_PAGES_1G,
+};
+
+struct buffer_config {
+	enum buffer_pages pages;
+	// Keep the buffer resident with mlock.
+	bool lock;
+};
+
+// Parses -H: "4k", "thp", "2m" or "1g", optionally followed by ":lock".
+// Returns false on errors.
+bool buffer_parse(const char *arg, struct buffer_config *config);
+// Describes the page size for the log.
+const char *buffer_page_desc(const struct buffer_config *config);
+
+// Allocates a page-aligned buffer of at least `size` bytes on the configured
+// NUMA node and faults it in so that no page faults happen during the
+// measurement. Exits on errors.
+void *buffer_alloc(size_t size, const struct buffer_config *config);
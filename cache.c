@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cache.h"
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define LINE 64
+
+static const char *action_names[] = {
+	[CACHE_LOAD] = "load",
+	[CACHE_DIRTY] = "dirty",
+	[CACHE_FLUSH] = "flush",
+	[CACHE_CLEAN] = "clean",
+	[CACHE_NT] = "nt",
+};
+
+static void (*apply)(uint8_t *start, uint8_t *end);
+static const char *impl_desc = "generic";
+
+// Keeps loads from being optimized out.
+static volatile uint64_t sink;
+
+bool cache_parse_action(const char *name, enum cache_action *action) {
+	for (unsigned i = 0; i < sizeof(action_names) / sizeof(*action_names); i++) {
+		if (!strcmp(name, action_names[i])) {
+			*action = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *cache_action_name(enum cache_action action) {
+	return action_names[action];
+}
+
+const char *cache_impl_desc() {
+	return impl_desc;
+}
+
+// Portable fallbacks touching one word per line.
+static void load_generic(uint8_t *p, uint8_t *end) {
+	uint64_t sum = 0;
+	for (; p < end; p += LINE)
+		sum += *(volatile uint64_t *) p;
+	sink = sum;
+}
+
+static void dirty_generic(uint8_t *p, uint8_t *end) {
+	for (; p < end; p += LINE) {
+		volatile uint64_t *w = (volatile uint64_t *) p;
+		*w = *w;
+	}
+}
+
+#if defined(__x86_64__)
+// Whole-line loads, reduced so that the compiler has to keep them.
+__attribute__((target("avx2")))
+static void load_avx2(uint8_t *p, uint8_t *end) {
+	__m256i acc = _mm256_setzero_si256();
+	for (; p < end; p += LINE) {
+		acc = _mm256_or_si256(acc, _mm256_load_si256((__m256i *) p));
+		acc = _mm256_or_si256(acc, _mm256_load_si256((__m256i *) (p + 32)));
+	}
+	sink = _mm256_extract_epi64(acc, 0);
+}
+
+__attribute__((target("avx512f")))
+static void load_avx512(uint8_t *p, uint8_t *end) {
+	__m512i acc = _mm512_setzero_si512();
+	for (; p < end; p += LINE)
+		acc = _mm512_or_si512(acc, _mm512_load_si512(p));
+	sink = _mm512_reduce_or_epi64(acc);
+}
+
+// Rewrites the lines with their own content. Workers may DMA into them
+// concurrently, but the buffer content doesn't matter.
+__attribute__((target("avx2")))
+static void dirty_avx2(uint8_t *p, uint8_t *end) {
+	for (; p < end; p += LINE) {
+		_mm256_store_si256((__m256i *) p, _mm256_load_si256((__m256i *) p));
+		_mm256_store_si256((__m256i *) (p + 32), _mm256_load_si256((__m256i *) (p + 32)));
+	}
+}
+
+__attribute__((target("avx512f")))
+static void dirty_avx512(uint8_t *p, uint8_t *end) {
+	for (; p < end; p += LINE)
+		_mm512_store_si512(p, _mm512_load_si512(p));
+}
+
+static void nt_sse2(uint8_t *p, uint8_t *end) {
+	__m128i zero = _mm_setzero_si128();
+	for (; p < end; p += LINE)
+		for (int i = 0; i < LINE; i += 16)
+			_mm_stream_si128((__m128i *) (p + i), zero);
+	_mm_sfence();
+}
+
+__attribute__((target("avx2")))
+static void nt_avx2(uint8_t *p, uint8_t *end) {
+	__m256i zero = _mm256_setzero_si256();
+	for (; p < end; p += LINE) {
+		_mm256_stream_si256((__m256i *) p, zero);
+		_mm256_stream_si256((__m256i *) (p + 32), zero);
+	}
+	_mm_sfence();
+}
+
+__attribute__((target("avx512f")))
+static void nt_avx512(uint8_t *p, uint8_t *end) {
+	__m512i zero = _mm512_setzero_si512();
+	for (; p < end; p += LINE)
+		_mm512_stream_si512((__m512i *) p, zero);
+	_mm_sfence();
+}
+
+static void flush_clflush(uint8_t *p, uint8_t *end) {
+	for (; p < end; p += LINE)
+		_mm_clflush(p);
+	_mm_mfence();
+}
+
+__attribute__((target("clflushopt")))
+static void flush_clflushopt(uint8_t *p, uint8_t *end) {
+	for (; p < end; p += LINE)
+		_mm_clflushopt(p);
+	_mm_sfence();
+}
+
+__attribute__((target("clwb")))
+static void clean_clwb(uint8_t *p, uint8_t *end) {
+	for (; p < end; p += LINE)
+		_mm_clwb(p);
+	_mm_sfence();
+}
+
+// CPUID leaf 7 feature bits in EBX.
+#define CPUID_CLFLUSHOPT (1 << 23)
+#define CPUID_CLWB (1 << 24)
+
+static unsigned leaf7_ebx() {
+	unsigned eax, ebx = 0, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+	return ebx;
+}
+
+void cache_init(enum cache_action action) {
+	__builtin_cpu_init();
+	bool avx512 = __builtin_cpu_supports("avx512f");
+	bool avx2 = __builtin_cpu_supports("avx2");
+	unsigned ebx = leaf7_ebx();
+	switch (action) {
+	case CACHE_LOAD:
+		apply = avx512 ? load_avx512 : avx2 ? load_avx2 : load_generic;
+		impl_desc = avx512 ? "AVX-512" : avx2 ? "AVX2" : "generic";
+		break;
+	case CACHE_DIRTY:
+		apply = avx512 ? dirty_avx512 : avx2 ? dirty_avx2 : dirty_generic;
+		impl_desc = avx512 ? "AVX-512" : avx2 ? "AVX2" : "generic";
+		break;
+	case CACHE_NT:
+		apply = avx512 ? nt_avx512 : avx2 ? nt_avx2 : nt_sse2;
+		impl_desc = avx512 ? "AVX-512" : avx2 ? "AVX2" : "SSE2";
+		break;
+	case CACHE_CLEAN:
+		if (ebx & CPUID_CLWB) {
+			apply = clean_clwb;
+			impl_desc = "clwb";
+			break;
+		}
+		// Flushing writes dirty lines back as well.
+		// fallthrough
+	case CACHE_FLUSH:
+		apply = ebx & CPUID_CLFLUSHOPT ? flush_clflushopt : flush_clflush;
+		impl_desc = ebx & CPUID_CLFLUSHOPT ? "clflushopt" : "clflush";
+		break;
+	}
+}
+#else
+void cache_init(enum cache_action action) {
+	// There are no portable flush or non-temporal instructions, dirtying
+	// comes closest to both.
+	apply = action == CACHE_LOAD ? load_generic : dirty_generic;
+}
+#endif
+
+void cache_apply(void *addr, size_t len) {
+	if (len == 0) return;
+	uint8_t *start = (uint8_t *) ((uintptr_t) addr & ~(uintptr_t) (LINE - 1));
+	uint8_t *end = (uint8_t *) addr + len;
+	apply(start, end);
+}
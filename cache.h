@@ -0,0 +1,45 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// What -c does with the buffer lines.
+enum cache_action {
+	// Load the lines into the cache.
+	CACHE_LOAD,
+	// Modify the lines so that DMA reads cause writebacks.
+	CACHE_DIRTY,
+	// Evict the lines (clflushopt) so that they are not cached.
+	CACHE_FLUSH,
+	// Write dirty lines back (clwb), possibly keeping them cached.
+	CACHE_CLEAN,
+	// Overwrite the lines with non-temporal stores, bypassing the cache.
+	CACHE_NT,
+};
+
+// Parses the action part of -c. Returns false on errors.
+bool cache_parse_action(const char *name, enum cache_action *action);
+const char *cache_action_name(enum cache_action action);
+// Picks the implementation for this CPU.
+void cache_init(enum cache_action action);
+// Describes the instructions used, e.g. "AVX2, clflushopt".
+const char *cache_impl_desc();
+
+// Applies the action to all cache lines overlapping the range.
+void cache_apply(void *addr, size_t len);
@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "control.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pattern.h"
+
+bool control_parse(struct control_config *config, const char *spec) {
+	char *s = strdup(spec), *save;
+	char *mode = strtok_r(s, ":", &save);
+	char *setpoint = strtok_r(NULL, ":", &save);
+	char *counter = strtok_r(NULL, "", &save);
+	bool ok = mode != NULL && setpoint != NULL && counter != NULL;
+	if (!ok) goto out;
+
+	config->kp = 0.5;
+	config->ki = 1;
+	config->kd = 0;
+	config->increase = 0.05;
+	config->decrease = 0.5;
+	char *params = strchr(mode, ',');
+	if (params) *params++ = '\0';
+	if (!strcmp(mode, "pid"))
+		config->mode = CONTROL_PID;
+	else if (!strcmp(mode, "aimd"))
+		config->mode = CONTROL_AIMD;
+	else
+		ok = false;
+	for (char *p = params ? strtok_r(params, ",", &save) : NULL; ok && p; p = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(p, '=');
+		if (!value) {
+			ok = false;
+			break;
+		}
+		*value++ = '\0';
+		if (!strcmp(p, "kp") && config->mode == CONTROL_PID) config->kp = atof(value);
+		else if (!strcmp(p, "ki") && config->mode == CONTROL_PID) config->ki = atof(value);
+		else if (!strcmp(p, "kd") && config->mode == CONTROL_PID) config->kd = atof(value);
+		else if (!strcmp(p, "inc") && config->mode == CONTROL_AIMD) config->increase = atof(value) / 100;
+		else if (!strcmp(p, "dec") && config->mode == CONTROL_AIMD) config->decrease = atof(value);
+		else ok = false;
+	}
+	config->setpoint = atof(setpoint);
+	config->counter = strdup(counter);
+	ok = ok && config->setpoint > 0 && config->increase > 0 && config->decrease > 0 && config->decrease < 1;
+out:
+	free(s);
+	return ok;
+}
+
+void control_print(const struct control_config *config) {
+	switch (config->mode) {
+	case CONTROL_NONE:
+		break;
+	case CONTROL_PID:
+		printf("Control: PID (kp %g, ki %g, kd %g) holding %s at %g/s\n",
+				config->kp, config->ki, config->kd, config->counter, config->setpoint);
+		break;
+	case CONTROL_AIMD:
+		printf("Control: AIMD (+%g%%, *%g) holding %s at %g/s\n",
+				config->increase * 100, config->decrease, config->counter, config->setpoint);
+		break;
+	}
+}
+
+void control_init(struct controller *c, const struct control_config *config, double rate) {
+	memset(c, 0, sizeof(*c));
+	c->config = config;
+	c->rate = rate;
+}
+
+double control_update(struct controller *c, double value, double blocks, double seconds) {
+	const struct control_config *config = c->config;
+	c->error = (config->setpoint - value) / config->setpoint;
+	if (c->base == 0) {
+		// Assume that the counter scales with the block rate for a first guess,
+		// but not beyond what the device can do.
+		if (blocks <= 0) return c->rate;
+		c->base = blocks * (value > 0 ? MIN(config->setpoint / value, 2) : 2);
+		c->rate = c->base;
+		c->prev_error = c->error;
+		return c->rate;
+	}
+
+	// More is pointless if the device doesn't keep up with the limit.
+	bool saturated = c->error > 0 && blocks < c->rate * 0.9;
+	switch (config->mode) {
+	case CONTROL_PID: {
+		if (!saturated)
+			c->integral += c->error * seconds;
+		double derivative = (c->error - c->prev_error) / seconds;
+		double output = 1 + config->kp * c->error + config->ki * c->integral + config->kd * derivative;
+		c->rate = c->base * MAX(output, 0.01);
+		break;
+	}
+	case CONTROL_AIMD:
+		if (c->error <= 0)
+			c->rate *= config->decrease;
+		else if (!saturated)
+			c->rate += c->base * config->increase;
+		break;
+	case CONTROL_NONE:
+		break;
+	}
+	c->prev_error = c->error;
+	c->rate = MIN(c->rate, 2 * MAX(blocks, c->base));
+	// A rate of 0 would disable the limit.
+	c->rate = MAX(c->rate, 1);
+	return c->rate;
+}
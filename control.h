@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Closed-loop control of the block rate limit so that a counter from -p
+// tracks a setpoint.
+enum control_mode {
+	CONTROL_NONE = 0,
+	CONTROL_PID,
+	CONTROL_AIMD,
+};
+
+struct control_config {
+	enum control_mode mode;
+	// Counter name, which also matches the per-socket values "<name>@<n>".
+	const char *counter;
+	// Target counter rate per second.
+	double setpoint;
+	// PID gains on the error relative to the setpoint, ki and kd per second.
+	double kp, ki, kd;
+	// AIMD increase relative to the initial rate and decrease factor.
+	double increase, decrease;
+};
+
+struct controller {
+	const struct control_config *config;
+	// Estimated block rate for the setpoint, 0 until the first interval.
+	double base;
+	// Current block rate limit.
+	double rate;
+	double integral, prev_error;
+	// Relative error of the last update.
+	double error;
+};
+
+// Parses -P: <pid|aimd>[,<param>=<value>...]:<setpoint>:<counter>.
+// Returns false on errors.
+bool control_parse(struct control_config *config, const char *spec);
+// Prints the configuration to stdout.
+void control_print(const struct control_config *config);
+
+// Starts with a block rate of `rate`, 0 for unlimited.
+void control_init(struct controller *c, const struct control_config *config, double rate);
+// Adjusts the block rate after an interval of `seconds` in which the counter
+// rate was `value` per second and the block rate was `blocks` per second.
+// Returns the new block rate.
+double control_update(struct controller *c, double value, double blocks, double seconds);
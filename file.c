@@ -0,0 +1,102 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct file_device {
+	int fd;
+	int lba_shift;
+};
+
+struct file_queue {
+	struct file_device *dev;
+	struct sync_completions *completions;
+};
+
+static void * file_open(const char *path, const char *options) {
+	struct file_device *dev = calloc(1, sizeof(*dev));
+	dev->fd = backend_open_direct(path);
+	return dev;
+}
+
+static void file_identify(void *_dev, struct ssd_features *features) {
+	struct file_device *dev = _dev;
+	backend_generic_identify(dev->fd, features);
+	dev->lba_shift = features->lba_shift;
+}
+
+static void * file_create_queue(void *dev, unsigned depth) {
+	struct file_queue *queue = calloc(1, sizeof(*queue));
+	queue->dev = dev;
+	queue->completions = sync_completions_create(depth);
+	return queue;
+}
+
+static void file_destroy_queue(void *_queue) {
+	struct file_queue *queue = _queue;
+	free(queue->completions);
+	free(queue);
+}
+
+static void file_submit(void *_queue, const struct io_request *req) {
+	struct file_queue *queue = _queue;
+	int fd = queue->dev->fd;
+	// Transfer the same amount of data as the 0-based NVMe commands.
+	size_t len = (req->block_count + 1) << queue->dev->lba_shift;
+	off_t offset = req->start_block << queue->dev->lba_shift;
+	ssize_t ret = 0;
+	switch (req->op) {
+	case OP_FLUSH:
+		ret = fdatasync(fd);
+		break;
+	// Operations are from memory perspective.
+	case OP_READ:
+		ret = pwrite(fd, req->buffer, len, offset);
+		break;
+	case OP_WRITE:
+		ret = pread(fd, req->buffer, len, offset);
+		break;
+	}
+	if (ret < 0) {
+		perror("read/write");
+		exit(1);
+	}
+	sync_completions_add(queue->completions, req->user_data);
+}
+
+static void file_flush(void *queue) {
+}
+
+static unsigned file_poll(void *_queue, uint64_t *user_data, unsigned min, unsigned max) {
+	struct file_queue *queue = _queue;
+	return sync_completions_poll(queue->completions, user_data, max);
+}
+
+const struct io_backend file_backend = {
+	.name = "file",
+	.desc = "Synchronous pread/pwrite on any block device or file.",
+	.open = file_open,
+	.identify = file_identify,
+	.create_queue = file_create_queue,
+	.destroy_queue = file_destroy_queue,
+	.submit = file_submit,
+	.flush = file_flush,
+	.poll = file_poll,
+};
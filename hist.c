@@ -0,0 +1,57 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hist.h"
+
+#include "pattern.h"
+
+// Returns the largest value that is counted in `bucket`.
+static uint64_t bucket_max(unsigned bucket) {
+	if (bucket < HIST_SUB_COUNT) return bucket;
+	unsigned shift = (bucket >> HIST_SUB_BITS) - 1;
+	uint64_t sub = HIST_SUB_COUNT + (bucket & (HIST_SUB_COUNT - 1));
+	return ((sub + 1) << shift) - 1;
+}
+
+void hist_add(struct histogram *dst, struct histogram *src) {
+	for (unsigned i = 0; i < HIST_BUCKETS; i++)
+		dst->count[i] += __atomic_load_n(&src->count[i], __ATOMIC_RELAXED);
+	dst->max = MAX(dst->max, __atomic_load_n(&src->max, __ATOMIC_RELAXED));
+}
+
+void hist_sub(struct histogram *dst, const struct histogram *src) {
+	for (unsigned i = 0; i < HIST_BUCKETS; i++)
+		dst->count[i] -= src->count[i];
+}
+
+uint64_t hist_total(const struct histogram *h) {
+	uint64_t total = 0;
+	for (unsigned i = 0; i < HIST_BUCKETS; i++)
+		total += h->count[i];
+	return total;
+}
+
+uint64_t hist_percentile(const struct histogram *h, double p) {
+	uint64_t total = hist_total(h);
+	if (total == 0) return 0;
+	uint64_t rank = MIN(p / 100 * total, total - 1), seen = 0;
+	for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		// Don't report more than the actual maximum for the last bucket.
+		if (seen > rank) return h->max ? MIN(bucket_max(i), h->max) : bucket_max(i);
+	}
+	return h->max;
+}
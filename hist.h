@@ -0,0 +1,61 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Log-linear histogram similar to HdrHistogram: every power of two is split
+// into 2^HIST_SUB_BITS linear buckets, giving a relative error of about 3%.
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+// Larger values end up in the last bucket.
+#define HIST_MAX_BITS 48
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+// Each histogram has a single writer. Readers may access it concurrently and
+// compute deltas between snapshots instead of resetting it.
+struct histogram {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t max;
+};
+
+static inline unsigned hist_bucket(uint64_t value) {
+	if (value < HIST_SUB_COUNT) return value;
+	unsigned shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	if (shift > HIST_MAX_BITS - HIST_SUB_BITS - 1) return HIST_BUCKETS - 1;
+	return ((shift + 1) << HIST_SUB_BITS) + ((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// Records a value. Must only be called by the owner of the histogram.
+static inline void hist_record(struct histogram *h, uint64_t value) {
+	uint64_t *c = &h->count[hist_bucket(value)];
+	// Plain load/store without lock prefix as there's only one writer.
+	__atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	if (value > __atomic_load_n(&h->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+}
+
+// Adds a snapshot of `src` to `dst`.
+void hist_add(struct histogram *dst, struct histogram *src);
+// Subtracts `src` from `dst`, i.e. turns two snapshots into a delta. The
+// maximum isn't reset, but percentile 100 of the delta is still exact up to
+// the bucket precision.
+void hist_sub(struct histogram *dst, const struct histogram *src);
+// Returns the number of recorded values.
+uint64_t hist_total(const struct histogram *h);
+// Returns the value at percentile `p` (0-100), or 0 if h is empty.
+uint64_t hist_percentile(const struct histogram *h, double p);
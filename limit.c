@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "limit.h"
+
+#include "pattern.h"
+
+void limit_init(struct rate_limit *l, double rate, uint64_t burst_ns) {
+	l->tat = 0;
+	l->burst_ns = burst_ns;
+	limit_set_rate(l, rate);
+}
+
+void limit_set_rate(struct rate_limit *l, double rate) {
+	uint64_t ps = rate > 0 ? MAX(1e12 / rate, 1) : 0;
+	__atomic_store_n(&l->ps_per_unit, ps, __ATOMIC_RELAXED);
+}
+
+double limit_get_rate(struct rate_limit *l) {
+	uint64_t ps = __atomic_load_n(&l->ps_per_unit, __ATOMIC_RELAXED);
+	return ps ? 1e12 / ps : 0;
+}
+
+uint64_t limit_take(struct rate_limit *l, uint64_t units, uint64_t now) {
+	uint64_t cost = units * __atomic_load_n(&l->ps_per_unit, __ATOMIC_RELAXED) / 1000;
+	// An idle limit can't save up more than the burst.
+	uint64_t earliest = now > l->burst_ns ? now - l->burst_ns : 0;
+	uint64_t tat = __atomic_load_n(&l->tat, __ATOMIC_RELAXED), start;
+	do {
+		start = MAX(tat, earliest);
+	} while (!__atomic_compare_exchange_n(&l->tat, &tat, start + cost, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return start;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lock-free rate limit using the generic cell rate algorithm, i.e. a token
+// bucket expressed as the time at which the bucket will be full again.
+// Every user reserves its share of time with a single compare-and-swap and
+// then waits until its slot starts, which paces commands evenly instead of
+// releasing them in bursts.
+struct rate_limit {
+	// Theoretical arrival time of the next unit in ns.
+	uint64_t tat;
+	// Cost of a single unit in ps, 0 if the limit is disabled.
+	uint64_t ps_per_unit;
+	// Time units can be saved up when idle.
+	uint64_t burst_ns;
+} __attribute__((aligned(64)));
+
+// Sets up a limit of `rate` units per second, 0 disables the limit.
+void limit_init(struct rate_limit *l, double rate, uint64_t burst_ns);
+// Changes the rate of a limit which may be in use.
+void limit_set_rate(struct rate_limit *l, double rate);
+// Returns the current rate in units per second.
+double limit_get_rate(struct rate_limit *l);
+
+static inline bool limit_active(struct rate_limit *l) {
+	return __atomic_load_n(&l->ps_per_unit, __ATOMIC_RELAXED) > 0;
+}
+
+// Takes `units` from the limit and returns the time at which they may be
+// used. A single reservation may exceed the remaining budget.
+uint64_t limit_take(struct rate_limit *l, uint64_t units, uint64_t now);
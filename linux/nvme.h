@@ -571,6 +571,28 @@ struct nvme_passthru_cmd {
 	__u32	result;
 };
 
+// Passed in the big SQE of IORING_OP_URING_CMD on the NVMe char device.
+struct nvme_uring_cmd {
+	__u8	opcode;
+	__u8	flags;
+	__u16	rsvd1;
+	__u32	nsid;
+	__u32	cdw2;
+	__u32	cdw3;
+	__u64	metadata;
+	__u64	addr;
+	__u32	metadata_len;
+	__u32	data_len;
+	__u32	cdw10;
+	__u32	cdw11;
+	__u32	cdw12;
+	__u32	cdw13;
+	__u32	cdw14;
+	__u32	cdw15;
+	__u32	timeout_ms;
+	__u32	rsvd2;
+};
+
 struct nvme_batch_user_io {
 	__u64 count;
 	struct nvme_user_io cmds[];
@@ -584,6 +606,7 @@ struct nvme_batch_user_io {
 #define NVME_IOCTL_ADMIN_CMD	_IOWR('N', 0x41, struct nvme_admin_cmd)
 #define NVME_IOCTL_SUBMIT_IO	_IOW('N', 0x42, struct nvme_user_io)
 #define NVME_IOCTL_IO_CMD	_IOWR('N', 0x43, struct nvme_passthru_cmd)
+#define NVME_URING_CMD_IO	_IOWR('N', 0x80, struct nvme_uring_cmd)
 // Custom commands
 #define NVME_IOCTL_SUPPORTS_CUSTOM_CMDS		_IO('N', 0x30)
 #define NVME_IOCTL_SUBMIT_BATCH_IO		_IOW('N', 0x31, struct nvme_batch_user_io)
@@ -15,12 +15,14 @@
  */
 
 #include <dlfcn.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <libgen.h>
 #include <math.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,27 +30,57 @@
 #include <time.h>
 #include <unistd.h>
 #include "linux/nvme.h" // Local header with additions.
+#include "arrival.h"
+#include "backend.h"
+#include "buffer.h"
+#include "cache.h"
+#include "control.h"
+#include "hist.h"
+#include "limit.h"
+#include "numa.h"
+#include "output.h"
 #include "nvme.h"
 #include "pattern.h"
 #include "random.h"
+#include "sweep.h"
+#include "stats.h"
 #include "pcm.h"
+#include "phase.h"
+#include "timing.h"
+#include "trace.h"
 
 #define handle_error(msg) \
 	do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
 static uint8_t *buffer;
 static struct ssd_features ssd_features;
+
+// Workers are distributed round-robin over the devices.
+struct device {
+	const char *path;
+	const struct io_backend *backend;
+	void *dev;
+	struct ssd_features features;
+	int workers;
+	// Queue depth without -q.
+	unsigned default_depth;
+	// Where commands writing to the device go.
+	struct block_dist dist;
+};
+static struct device *devices;
+static int device_count;
 static pthread_mutex_t pattern_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct pattern *pattern;
-static long long block_limit, command_limit;
+static struct rate_limit block_limit, command_limit;
 static long long global_block_limit, global_command_limit;
-static pthread_mutex_t limit_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t limit_cond = PTHREAD_COND_INITIALIZER;
 
 static struct {
 	bool cache_once;
 	bool cache_always;
+	enum cache_action cache_action;
 	int parallelism;
+	int queue_depth;
+	const char *backend;
 	long long block_limit;
 	long long command_limit;
 	long limit_resolution;
@@ -56,10 +88,23 @@ static struct {
 	int time_limit;
 	long long global_block_limit;
 	long long global_command_limit;
+	struct arrival_config arrival;
+	const char *record_path;
+	const char *numa_memory;
+	const char *numa_cpus;
+	struct buffer_config buffer;
+	long interval_ms;
+	struct block_dist block_dist;
+	struct phase_config phase;
+	struct sweep sweep;
+	struct control_config control;
 } opts = {
 	.cache_once = false,
 	.cache_always = false,
+	.cache_action = CACHE_LOAD,
 	.parallelism = 1,
+	.queue_depth = 0,
+	.backend = NULL,
 	.block_limit = 0,
 	.command_limit = 0,
 	.limit_resolution = 0,
@@ -67,19 +112,91 @@ static struct {
 	.time_limit = 0,
 	.global_block_limit = 0,
 	.global_command_limit = 0,
+	.arrival = { .process = ARRIVAL_NONE },
+	.record_path = NULL,
+	.numa_memory = NULL,
+	.numa_cpus = NULL,
+	.buffer = { .pages = BUFFER_PAGES_SMALL, .lock = false },
+	.interval_ms = 1000,
+	.block_dist = { .kind = DIST_UNIFORM, .granularity = 1 },
+	.phase = { .warmup_ns = 0, .warmup_commands = 0, .cv = 0 },
+	.sweep = { .axis_count = 0 },
+	.control = { .mode = CONTROL_NONE },
 };
 
+// Number of commands to get from the pattern at once.
+#define CMD_BATCH 64
+
 struct worker_state {
 	pthread_t thread_id;
-	uint64_t block_count;
-	uint64_t command_count;
-};
+	int index;
+	// The device this worker submits to and its index among the device's workers.
+	struct device *device;
+	int device_index;
+	// Per-worker pattern state.
+	void *pattern_state;
+	struct rng rng;
+	// Commands from the pattern that haven't been executed yet.
+	struct cmd cmds[CMD_BATCH];
+	unsigned cmd_pos, cmd_count;
+
+	// Backend queue with up to `depth` commands in flight, identified by their slot.
+	void *queue;
+	int depth;
+	struct cmd *slots;
+	uint64_t *submitted;
+	uint64_t *free_slots, *completed;
+	int free_count;
+	// Counters read by the reporter, on their own cache line.
+	struct worker_stats *stats;
+	// Submit to completion latency in ns per operation.
+	struct histogram *latency[STATS_OPS];
+
+	// Open-loop schedule.
+	struct arrival arrival;
+	// Time the current command was due, 0 if it wasn't scheduled.
+	uint64_t scheduled;
+	// Time between schedule and submission in ns.
+	struct histogram *queue_delay;
 
-// Used to move values to the cache, must not be optimized out.
-uint8_t dummy_sum;
+	// Commands to record with -R.
+	struct trace_buffer *trace;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct worker_state *workers;
+static struct worker_stats *worker_stats;
+// Start of the open-loop schedule.
+static uint64_t start_time;
+// Values summed up for the controlled counter.
+static int *control_counters, control_counter_count;
+// Parameters of the current sweep point for the summary.
+static int sweep_point_count;
+static const char *sweep_point_names[SWEEP_PARAMS], *sweep_point_values[SWEEP_PARAMS];
+
+// Set on interrupts and limits. Workers stop taking new commands and finish
+// the ones in flight, then the reporter prints the final summary.
+static int stop;
+// Workers that haven't finished yet.
+static int workers_running;
+// How often long waits check for a stop.
+#define STOP_CHECK_NS 10000000
+
+static inline bool stopping() {
+	return __atomic_load_n(&stop, __ATOMIC_RELAXED);
+}
+
+static void request_stop() {
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+}
 
 static void signal_handler(int sig) {
-	exit(0);
+	// Interrupting twice doesn't wait for the drain.
+	if (stopping()) _exit(1);
+	request_stop();
+}
+
+// Only interrupts waits, see PATTERN_WAKE_SIGNAL.
+static void wake_handler(int sig) {
 }
 
 static char *get_pattern_path(char *pattern) {
@@ -100,129 +217,845 @@ static char *get_pattern_path(char *pattern) {
 	return buffer;
 }
 
-static void get_ssd_features() {
-	int err;
-	struct nvme_id_ns ns;
-	struct nvme_id_ctrl ctrl;
-	err = nvme_identify(&ns, 0);
-	if (err < 0) return;
-	err = nvme_identify(&ctrl, 1);
-
-	memcpy(ssd_features.sn, ctrl.sn, 20);
-	ssd_features.sn[20] = 0;
-	memcpy(ssd_features.mn, ctrl.mn, 40);
-	ssd_features.mn[40] = 0;
-	ssd_features.size = ns.nsze;
-	ssd_features.lba_shift = ns.lbaf[ns.flbas].ds;
-	ssd_features.max_block_count = pow(2, ctrl.mdts + 12 - ssd_features.lba_shift);
+// Picks the backend from -e or the type of device.
+static void open_device(struct device *device, const char *path) {
+	const struct io_backend *backend;
+	char *options = NULL;
+	if (opts.backend) {
+		char *name = strdup(opts.backend);
+		options = strchr(name, ':');
+		if (options) *options++ = '\0';
+		backend = backend_find(name);
+		if (backend == NULL) {
+			fprintf(stderr, "Unknown backend %s\n", name);
+			exit(1);
+		}
+	} else if (opts.queue_depth > 0 || opts.arrival.process != ARRIVAL_NONE) {
+		backend = &uring_backend;
+	} else {
+		// Use NVMe ioctls if possible.
+		backend = &file_backend;
+		int fd = open(path, O_RDONLY);
+		if (fd >= 0 && nvme_get_nsid(fd) != (uint32_t) -1)
+			backend = &nvme_backend;
+		if (fd >= 0) close(fd);
+	}
+	device->path = path;
+	device->backend = backend;
+	device->dev = backend->open(path, options);
+	backend->identify(device->dev, &device->features);
+	device->default_depth = backend->default_depth ? backend->default_depth(device->dev) : 1;
+}
+
+// Default queue depth with -A, so that commands don't have to wait for the
+// previous ones to complete.
+#define ARRIVAL_DEPTH 64
+
+// Returns the number of commands each worker of `device` keeps in flight.
+static unsigned device_depth(const struct device *device) {
+	if (opts.queue_depth > 0)
+		return opts.queue_depth;
+	if (opts.arrival.process != ARRIVAL_NONE)
+		return MAX(device->default_depth, ARRIVAL_DEPTH);
+	return device->default_depth;
 }
 
-// Performs an IO (i.e. read/write to SSD) command.
-static void perform_io(struct cmd *cmd) {
-	int err;
-	uint64_t ssd_block = 0;
+// Opens the comma-separated devices. ssd_features describes what they have in common.
+static void open_devices(char *paths) {
+	for (char *path = strtok(paths, ","); path; path = strtok(NULL, ",")) {
+		devices = realloc(devices, (device_count + 1) * sizeof(*devices));
+		struct device *device = &devices[device_count++];
+		memset(device, 0, sizeof(*device));
+		open_device(device, path);
+		device->dist = opts.block_dist;
+		block_dist_prepare(&device->dist, device->features.size, device->features.max_block_count);
+		if (device_count == 1) {
+			ssd_features = device->features;
+			continue;
+		}
+		// Everything shares a buffer indexed in blocks.
+		if (device->features.lba_shift != ssd_features.lba_shift) {
+			fprintf(stderr, "%s: block size differs from %s\n", path, devices[0].path);
+			exit(1);
+		}
+		ssd_features.size = MIN(ssd_features.size, device->features.size);
+		ssd_features.max_block_count = MIN(ssd_features.max_block_count, device->features.max_block_count);
+	}
+	if (device_count == 0) {
+		fprintf(stderr, "No device given\n");
+		exit(1);
+	}
+}
+
+// Returns the number of blocks a command transfers. block_count is 0-based
+// like the NVMe field, flushes don't transfer anything.
+static inline uint64_t cmd_blocks(const struct cmd *cmd) {
+	return cmd->op == OP_FLUSH ? 0 : cmd->block_count + 1;
+}
+
+// Returns the SSD block a command should access.
+static uint64_t get_ssd_block(struct worker_state *state, struct cmd *cmd) {
 	// Randomize SSD write target for optimal performance.
-	if (cmd->op == OP_READ) ssd_block = get_random_block(ssd_features.size, cmd->block_count);
-	if (cmd->op == OP_FLUSH) {
-		err = nvme_io_cmd(cmd->op);
+	if (cmd->op == OP_READ) return block_dist_next(&state->device->dist, &state->rng);
+	return 0;
+}
+
+#define LIMIT_REACHED(limit) (opts.limit > 0 && __atomic_load_n(&limit, __ATOMIC_RELAXED) < 0)
+
+static void init_worker(struct worker_state *state, int index) {
+	state->index = index;
+	state->device = &devices[index % device_count];
+	state->device_index = index / device_count;
+	rng_init(&state->rng);
+	state->stats = &worker_stats[index];
+	for (int op = 0; op < STATS_OPS; op++)
+		state->latency[op] = calloc(1, sizeof(*state->latency[op]));
+	state->queue_delay = calloc(1, sizeof(*state->queue_delay));
+	if (opts.arrival.process != ARRIVAL_NONE)
+		arrival_init(&state->arrival, &opts.arrival, index, opts.parallelism, start_time);
+	if (opts.record_path)
+		state->trace = calloc(1, sizeof(*state->trace));
+}
+
+// Refills the worker's command buffer from the pattern.
+static void fill_cmds(struct worker_state *state) {
+	state->cmd_pos = 0;
+	if (pattern->next_cmds) {
+		state->cmd_count = pattern->next_cmds(state->pattern_state, &state->device->features, state->cmds, CMD_BATCH);
+	} else if (pattern->next) {
+		for (int i = 0; i < CMD_BATCH; i++)
+			state->cmds[i] = pattern->next(state->pattern_state, &state->device->features);
+		state->cmd_count = CMD_BATCH;
 	} else {
-		err = nvme_io(
-				cmd->op,
-				buffer + (cmd->target_block << ssd_features.lba_shift),
-				ssd_block,
-				cmd->block_count);
+		// Old patterns have global state, so we need a mutex.
+		pthread_mutex_lock(&pattern_mutex);
+		for (int i = 0; i < CMD_BATCH; i++)
+			state->cmds[i] = pattern->next_cmd(&state->device->features);
+		pthread_mutex_unlock(&pattern_mutex);
+		state->cmd_count = CMD_BATCH;
 	}
-	if (err != 0) exit(1);
 }
 
-static void put_in_cache(size_t start, size_t count) {
-	for (size_t i = 0; i < count; i++) {
-		dummy_sum += buffer[start + i];
+// Processes completed commands, waiting for at least `min` of them.
+static void reap(struct worker_state *state, unsigned min) {
+	unsigned n = state->device->backend->poll(state->queue, state->completed, min, state->depth);
+	uint64_t now = n > 0 ? now_ns() : 0;
+	for (unsigned i = 0; i < n; i++) {
+		uint64_t slot = state->completed[i];
+		struct cmd *cmd = &state->slots[slot];
+		hist_record(state->latency[cmd->op], now - state->submitted[slot]);
+		stats_add(&state->stats->total.blocks, cmd_blocks(cmd));
+		stats_add(&state->stats->total.commands, 1);
+		stats_add(&state->stats->ops[cmd->op].blocks, cmd_blocks(cmd));
+		stats_add(&state->stats->ops[cmd->op].commands, 1);
+		state->free_slots[state->free_count++] = slot;
 	}
 }
 
-static inline bool limit_enabled() {
-	return opts.block_limit > 0 || opts.command_limit > 0 || opts.global_block_limit > 0 || opts.global_command_limit > 0;
+// Waits until `time`. Keeps reaping commands in flight meanwhile so that
+// their latency is measured accurately.
+static void wait_reaping(struct worker_state *state, uint64_t time) {
+	// Commands must not sit in a backend batch while we wait.
+	state->device->backend->flush(state->queue);
+	// The caller already holds the slot of the command it waits for, so
+	// only spin while others are in flight and sleep afterwards.
+	while (state->free_count + 1 < state->depth) {
+		if (now_ns() >= time || stopping()) return;
+		reap(state, 0);
+		cpu_relax();
+	}
+	for (uint64_t now = now_ns(); now < time && !stopping(); now = now_ns())
+		wait_until_ns(MIN(time, now + STOP_CHECK_NS));
 }
 
-#define LIMIT_REACHED(limit) (opts.limit > 0 && limit < 0)
+// Optional worker features. The worker loop is compiled once for every
+// combination so that disabled features cost nothing per command.
+#define WORKER_BLOCK_LIMIT   (1 << 0)
+#define WORKER_COMMAND_LIMIT (1 << 1)
+#define WORKER_GLOBAL_LIMIT  (1 << 2)
+#define WORKER_CACHE         (1 << 3)
+#define WORKER_ARRIVAL       (1 << 4)
+#define WORKER_TRACE         (1 << 5)
+#define WORKER_VARIANTS      (1 << 6)
 
-static void init_worker(struct worker_state *state) {
-	state->block_count = 0;
-	state->command_count = 0;
+static unsigned worker_flags() {
+	// The controller may enable the block limit later.
+	return (limit_active(&block_limit) || opts.control.mode != CONTROL_NONE ? WORKER_BLOCK_LIMIT : 0) |
+		(limit_active(&command_limit) ? WORKER_COMMAND_LIMIT : 0) |
+		(opts.global_block_limit > 0 || opts.global_command_limit > 0 ? WORKER_GLOBAL_LIMIT : 0) |
+		(opts.cache_always ? WORKER_CACHE : 0) |
+		(opts.arrival.process != ARRIVAL_NONE ? WORKER_ARRIVAL : 0) |
+		(opts.record_path ? WORKER_TRACE : 0);
 }
 
-static void *run_worker(void *arg) {
-	struct worker_state *state = arg;
-	struct cmd cmd;
-	for (;;) {
-		// Get a new command. The patterns usually have internal state, so we need a mutex.
-		pthread_mutex_lock(&pattern_mutex);
-		cmd = pattern->next_cmd(&ssd_features);
-		pthread_mutex_unlock(&pattern_mutex);
+// Gets the next command to execute, waiting for the limit if necessary.
+// Returns false if the pattern or the global limit is exhausted or on stop.
+static inline __attribute__((always_inline))
+bool get_next_cmd(struct worker_state *state, struct cmd *cmd, const unsigned flags) {
+	if (stopping()) return false;
+	if (state->cmd_pos == state->cmd_count) {
+		fill_cmds(state);
+		if (state->cmd_count == 0) return false;
+	}
+	*cmd = state->cmds[state->cmd_pos++];
 
-		if (limit_enabled()) {
-			// The limit is shared by all workers and periodically reset by the main thread.
-			pthread_mutex_lock(&limit_mutex);
-			while (LIMIT_REACHED(block_limit) || LIMIT_REACHED(command_limit))
-				pthread_cond_wait(&limit_cond, &limit_mutex);
-			// Allow a single operation to go over the limit.
-			block_limit -= cmd.block_count;
-			command_limit -= 1;
-			global_block_limit -= cmd.block_count;
-			global_command_limit -= 1;
-			pthread_mutex_unlock(&limit_mutex);
-
-			if (LIMIT_REACHED(global_block_limit) || LIMIT_REACHED(global_command_limit))
-				return NULL;
-		}
+	// Commands that are already late go out immediately.
+	state->scheduled = 0;
+	if (cmd->time)
+		state->scheduled = start_time + cmd->time;
+	else if (flags & WORKER_ARRIVAL)
+		state->scheduled = arrival_next(&state->arrival);
+	if (state->scheduled > now_ns())
+		wait_reaping(state, state->scheduled);
+
+	if (flags & (WORKER_BLOCK_LIMIT | WORKER_COMMAND_LIMIT)) {
+		// Reserve a slot with both limits and wait for the later one.
+		uint64_t now = now_ns(), start = 0, command_start = 0;
+		if ((flags & WORKER_BLOCK_LIMIT) && limit_active(&block_limit))
+			start = limit_take(&block_limit, cmd_blocks(cmd), now);
+		if ((flags & WORKER_COMMAND_LIMIT) && limit_active(&command_limit))
+			command_start = limit_take(&command_limit, 1, now);
+		start = MAX(start, command_start);
+		if (start > now)
+			wait_reaping(state, start);
+	}
+	// Waits may have been cut short.
+	if ((state->scheduled || (flags & (WORKER_BLOCK_LIMIT | WORKER_COMMAND_LIMIT))) && stopping())
+		return false;
+
+	if (flags & WORKER_GLOBAL_LIMIT) {
+		if (opts.global_block_limit > 0 && __atomic_sub_fetch(&global_block_limit, cmd_blocks(cmd), __ATOMIC_RELAXED) < 0)
+			return false;
+		if (opts.global_command_limit > 0 && __atomic_sub_fetch(&global_command_limit, 1, __ATOMIC_RELAXED) < 0)
+			return false;
+	}
+
+	if (flags & WORKER_CACHE)
+		cache_apply(buffer + (cmd->target_block << ssd_features.lba_shift), (cmd->block_count + 1) << ssd_features.lba_shift);
+	return true;
+}
 
-		if (opts.cache_always)
-			put_in_cache(cmd.target_block << ssd_features.lba_shift, cmd.block_count << ssd_features.lba_shift);
+// Keeps up to device_depth() commands in flight.
+static inline __attribute__((always_inline))
+void *worker_loop(struct worker_state *state, const unsigned flags) {
+	// Pin first so that the queue and state end up on the local node.
+	numa_pin_worker(state->index);
+	struct device *device = state->device;
+	int depth = state->depth = device_depth(device);
+	// The backend is in another translation unit, but at least the compiler
+	// doesn't have to reload its function pointers for every command.
+	const struct io_backend backend = *device->backend;
+	state->queue = backend.create_queue(device->dev, depth);
+	state->slots = calloc(depth, sizeof(*state->slots));
+	state->submitted = calloc(depth, sizeof(*state->submitted));
+	state->free_slots = calloc(depth, sizeof(*state->free_slots));
+	state->completed = calloc(depth, sizeof(*state->completed));
+	state->free_count = depth;
+	for (int i = 0; i < depth; i++) state->free_slots[i] = i;
+	if (pattern->init)
+		state->pattern_state = pattern->init(&state->device->features, state->device_index, state->device->workers);
 
-		perform_io(&cmd);
+	bool done = false;
+	while (!done || state->free_count < depth) {
+		while (!done && state->free_count > 0) {
+			uint64_t slot = state->free_slots[--state->free_count];
+			struct cmd *cmd = &state->slots[slot];
+			if (!get_next_cmd(state, cmd, flags)) {
+				state->free_slots[state->free_count++] = slot;
+				done = true;
+				break;
+			}
+			uint64_t now = state->submitted[slot] = now_ns();
+			if (state->scheduled) {
+				uint64_t delay = now > state->scheduled ? now - state->scheduled : 0;
+				hist_record(state->queue_delay, delay);
+				stats_set(&state->stats->lag, delay);
+				// Late commands count their wait as latency, otherwise a slow
+				// device would hide its own backlog.
+				state->submitted[slot] = now - delay;
+			}
+			if (flags & WORKER_TRACE)
+				trace_add(state->trace, cmd, now - start_time);
+			backend.submit(state->queue, &(struct io_request) {
+				.op = cmd->op,
+				.buffer = buffer + (cmd->target_block << ssd_features.lba_shift),
+				.start_block = get_ssd_block(state, cmd),
+				.block_count = cmd->block_count,
+				.user_data = slot,
+			});
+		}
 
-		state->block_count += cmd.block_count;
-		state->command_count++;
+		reap(state, state->free_count < depth ? 1 : 0);
 	}
+	backend.destroy_queue(state->queue);
+	free(state->slots);
+	free(state->submitted);
+	free(state->free_slots);
+	free(state->completed);
+	if (pattern->destroy)
+		pattern->destroy(state->pattern_state);
+	__atomic_sub_fetch(&workers_running, 1, __ATOMIC_RELAXED);
 	return NULL;
 }
 
-static void *run_limiter(void *arg) {
-	if (!limit_enabled()) return NULL;
+// Instantiates worker_loop for all flag combinations, named by their bits.
+#define WORKER_VARIANT(bits) \
+	static void *run_worker_##bits(void *arg) { return worker_loop(arg, bits); }
+#define WORKER_ENTRY(bits) [bits] = run_worker_##bits,
+#define WORKER_BITS1(X, p) X(p##0) X(p##1)
+#define WORKER_BITS2(X, p) WORKER_BITS1(X, p##0) WORKER_BITS1(X, p##1)
+#define WORKER_BITS3(X, p) WORKER_BITS2(X, p##0) WORKER_BITS2(X, p##1)
+#define WORKER_BITS4(X, p) WORKER_BITS3(X, p##0) WORKER_BITS3(X, p##1)
+#define WORKER_BITS5(X, p) WORKER_BITS4(X, p##0) WORKER_BITS4(X, p##1)
+#define WORKER_BITS6(X, p) WORKER_BITS5(X, p##0) WORKER_BITS5(X, p##1)
 
-	long res = opts.limit_resolution;
-	struct timespec t = { .tv_sec = 1, .tv_nsec = 0 };
-	if (res > 1) {
-		t.tv_sec = 0;
-		t.tv_nsec = 1000000000L / res;
-	} else {
-		res = 1;
+WORKER_BITS6(WORKER_VARIANT, 0b)
+
+static void *(*const worker_variants[WORKER_VARIANTS])(void *) = {
+	WORKER_BITS6(WORKER_ENTRY, 0b)
+};
+
+// Merges a snapshot of the `count` histograms at `offset` in all workers into `h`.
+static void collect_histograms(struct histogram *h, size_t offset, int count) {
+	memset(h, 0, sizeof(*h));
+	for (int i = 0; i < opts.parallelism; i++)
+		for (int j = 0; j < count; j++)
+			hist_add(h, ((struct histogram **) ((char *) &workers[i] + offset))[j]);
+}
+#define LATENCY_OFFSET(op) (offsetof(struct worker_state, latency) + (op) * sizeof(struct histogram *))
+#define collect_latency(h) collect_histograms(h, LATENCY_OFFSET(0), STATS_OPS)
+#define collect_op_latency(h, op) collect_histograms(h, LATENCY_OFFSET(op), 1)
+#define collect_queue_delay(h) collect_histograms(h, offsetof(struct worker_state, queue_delay), 1)
+
+// Tracks the interval deltas of one histogram kind.
+struct interval_hist {
+	struct histogram *delta, *snapshot, *prev_snapshot;
+};
+
+static void interval_hist_init(struct interval_hist *ih) {
+	ih->delta = malloc(sizeof(*ih->delta));
+	ih->snapshot = malloc(sizeof(*ih->snapshot));
+	ih->prev_snapshot = calloc(1, sizeof(*ih->prev_snapshot));
+}
+
+static void interval_hist_free(struct interval_hist *ih) {
+	free(ih->delta);
+	free(ih->snapshot);
+	free(ih->prev_snapshot);
+}
+
+// Updates ih->delta from the current state of the workers.
+static void interval_hist_update(struct interval_hist *ih, size_t offset, int count) {
+	struct histogram *tmp;
+	collect_histograms(ih->snapshot, offset, count);
+	memcpy(ih->delta, ih->snapshot, sizeof(*ih->delta));
+	hist_sub(ih->delta, ih->prev_snapshot);
+	tmp = ih->prev_snapshot;
+	ih->prev_snapshot = ih->snapshot;
+	ih->snapshot = tmp;
+}
+
+static void print_percentiles(const char *name, const struct histogram *h) {
+	printf("%s p50/p90/p99/p99.9/max: %.1f/%.1f/%.1f/%.1f/%.1f us", name,
+			hist_percentile(h, 50) / 1e3,
+			hist_percentile(h, 90) / 1e3,
+			hist_percentile(h, 99) / 1e3,
+			hist_percentile(h, 99.9) / 1e3,
+			hist_percentile(h, 100) / 1e3);
+}
+
+static void trace_finish() {
+	for (int i = 0; i < opts.parallelism; i++)
+		trace_flush(workers[i].trace);
+	trace_close();
+}
+
+static const char *op_names[STATS_OPS] = {
+	[OP_FLUSH] = "flush",
+	[OP_READ] = "read",
+	[OP_WRITE] = "write",
+};
+
+// Whether both reads and writes have been seen, which adds a breakdown.
+static bool mixed_ops() {
+	uint64_t reads = 0, writes = 0;
+	for (int i = 0; i < opts.parallelism; i++) {
+		reads += __atomic_load_n(&worker_stats[i].ops[OP_READ].commands, __ATOMIC_RELAXED);
+		writes += __atomic_load_n(&worker_stats[i].ops[OP_WRITE].commands, __ATOMIC_RELAXED);
+	}
+	return reads > 0 && writes > 0;
+}
+
+// Histograms at the end of the warm-up, subtracted from the summary.
+enum {
+	WARMUP_LATENCY,
+	WARMUP_QUEUE_DELAY,
+	WARMUP_OP_LATENCY,
+	WARMUP_HISTOGRAMS = WARMUP_OP_LATENCY + STATS_OPS,
+};
+
+// Totals of a run, not counting the warm-up.
+struct run_result {
+	double elapsed, steady, peak;
+	struct counters total;
+	// Filled in by print_summary().
+	double latency_p50, latency_p99;
+	bool interrupted;
+};
+
+// Prints totals after all workers have stopped.
+static void print_summary(struct run_result *r, const struct histogram *warmup) {
+	struct histogram *h = malloc(sizeof(*h)), *q = malloc(sizeof(*q));
+	collect_latency(h);
+	hist_sub(h, &warmup[WARMUP_LATENCY]);
+	collect_queue_delay(q);
+	hist_sub(q, &warmup[WARMUP_QUEUE_DELAY]);
+	double average = r->elapsed > 0 ? r->total.blocks / r->elapsed : 0;
+	printf("\nOverall %"PRIu64" blocks (%"PRIu64" MiB) via %"PRIu64" commands in %.3f s, %.1f MiB/s average, %.1f MiB/s peak\n",
+			r->total.blocks, (r->total.blocks << ssd_features.lba_shift) >> 20, r->total.commands, r->elapsed,
+			average * (1 << ssd_features.lba_shift) / (1 << 20), r->peak * (1 << ssd_features.lba_shift) / (1 << 20));
+	printf("Overall ");
+	print_percentiles("latency", h);
+	if (hist_total(q) > 0) {
+		printf(", ");
+		print_percentiles("queueing", q);
+	}
+	putchar('\n');
+	if (r->steady >= 0)
+		printf("Steady after %.3f s\n", r->steady);
+	r->latency_p50 = hist_percentile(h, 50) / 1e3;
+	r->latency_p99 = hist_percentile(h, 99) / 1e3;
+	output_summary(&(struct output_summary) {
+		.params = sweep_point_count,
+		.param_names = sweep_point_names,
+		.param_values = sweep_point_values,
+		.elapsed = r->elapsed,
+		.steady = r->steady,
+		.lba_shift = ssd_features.lba_shift,
+		.total = r->total,
+		.peak_blocks_per_s = r->peak,
+		.latency = h,
+		.queue_delay = q,
+	});
+	if (mixed_ops()) {
+		for (int op = OP_READ; op <= OP_WRITE; op++) {
+			collect_op_latency(h, op);
+			hist_sub(h, &warmup[WARMUP_OP_LATENCY + op]);
+			printf("  %s: %"PRIu64" commands, ", op_names[op], hist_total(h));
+			print_percentiles("latency", h);
+			putchar('\n');
+		}
+	}
+	free(h);
+	free(q);
+}
+
+// Runs the workers with the current options until they stop and prints the
+// summary.
+static void run(struct run_result *result) {
+	// A small default burst lets late workers catch up instead of losing throughput.
+	uint64_t burst_ns = 1000000000L / (opts.limit_resolution > 0 ? opts.limit_resolution : 1000);
+	limit_init(&block_limit, opts.block_limit, burst_ns);
+	limit_init(&command_limit, opts.command_limit, burst_ns);
+	global_block_limit = opts.global_block_limit;
+	global_command_limit = opts.global_command_limit;
+	__atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+	struct controller controller;
+	control_init(&controller, &opts.control, opts.block_limit);
+
+	start_time = now_ns();
+	// Workers write their own state all the time, so keep it on separate cache lines.
+	workers = aligned_alloc(CACHE_LINE_SIZE, opts.parallelism * sizeof(*workers));
+	memset(workers, 0, opts.parallelism * sizeof(*workers));
+	worker_stats = stats_alloc(opts.parallelism);
+	for (int i = 0; i < device_count; i++)
+		devices[i].workers = 0;
+	for (int i = 0; i < opts.parallelism; i++)
+		devices[i % device_count].workers++;
+	void *(*run_worker)(void *) = worker_variants[worker_flags()];
+	workers_running = opts.parallelism;
+	for (int i = 0; i < opts.parallelism; i++) {
+		init_worker(&workers[i], i);
+		pthread_create(&workers[i].thread_id, NULL, run_worker, &workers[i]);
+	}
+
+	uint64_t interval_ns = opts.interval_ms * 1000000ull;
+	uint64_t report_time = start_time, prev_report_time;
+	unsigned pcm_count = opts.enable_pcm ? pcm_get_counter_count() : 0;
+	uint64_t *pcm_values = calloc(pcm_count, sizeof(*pcm_values));
+	uint64_t *pcm_deltas = calloc(pcm_count, sizeof(*pcm_deltas));
+	const char **pcm_names = calloc(pcm_count, sizeof(*pcm_names));
+	for (int i = 0; i < pcm_count; i++)
+		pcm_names[i] = pcm_get_counter_name(i);
+	uint64_t *pcm_next = calloc(pcm_count, sizeof(*pcm_next));
+	// Counters keep running between sweep points.
+	if (pcm_count > 0)
+		pcm_get_values(pcm_values);
+	struct counters total, interval;
+	struct counters *worker_total = calloc(opts.parallelism, sizeof(*worker_total));
+	struct counters *worker_interval = calloc(opts.parallelism, sizeof(*worker_interval));
+	struct counters *device_interval = calloc(device_count, sizeof(*device_interval));
+	const char **device_names = calloc(device_count, sizeof(*device_names));
+	for (int i = 0; i < device_count; i++)
+		device_names[i] = devices[i].path;
+	// Histograms are never reset, we compare snapshots instead.
+	struct interval_hist latency, queue_delay, op_latency[STATS_OPS];
+	interval_hist_init(&latency);
+	interval_hist_init(&queue_delay);
+	for (int op = 0; op < STATS_OPS; op++)
+		interval_hist_init(&op_latency[op]);
+	struct counters op_total[STATS_OPS], op_prev[STATS_OPS], op_interval[STATS_OPS];
+	memset(op_prev, 0, sizeof(op_prev));
+	const struct histogram *op_latency_delta[STATS_OPS];
+	uint64_t prev_lag = 0;
+	double peak = 0;
+	// Statistics only cover the time after the warm-up.
+	struct phase_tracker phase;
+	phase_init(&phase, &opts.phase);
+	uint64_t measure_start = start_time;
+	struct counters warmup_total = { 0, 0 };
+	struct histogram *warmup_hist = calloc(WARMUP_HISTOGRAMS, sizeof(*warmup_hist));
+	double steady = -1;
+	bool steady_stop = false;
+	bool final = false;
+	while (!final) {
+		// Sleep until absolute deadlines so that short intervals don't drift.
+		// Wake up early when stopping or when all workers are done.
+		prev_report_time = report_time;
+		report_time += interval_ns;
+		for (uint64_t now = now_ns(); now < report_time && !stopping() &&
+				__atomic_load_n(&workers_running, __ATOMIC_RELAXED) > 0; now = now_ns())
+			sleep_until_ns(MIN(report_time, now + STOP_CHECK_NS));
+		uint64_t now = now_ns();
+
+		bool interrupted = stopping() && !steady_stop;
+		bool time_up = opts.time_limit && phase.phase != PHASE_WARMUP &&
+			now - measure_start >= opts.time_limit * 1000000000ull;
+		if (stopping() || time_up || __atomic_load_n(&workers_running, __ATOMIC_RELAXED) == 0) {
+			// The last interval includes the drain.
+			request_stop();
+			for (int i = 0; i < opts.parallelism; i++) {
+				pthread_kill(workers[i].thread_id, PATTERN_WAKE_SIGNAL);
+				pthread_join(workers[i].thread_id, NULL);
+			}
+			now = now_ns();
+			final = true;
+		}
+		// Rates are per second even if the interval is shorter or we overslept.
+		double seconds = (now - prev_report_time) / 1e9;
+		report_time = now;
+
+		total = (struct counters) { 0, 0 };
+		for (int i = 0; i < opts.parallelism; i++) {
+			struct counters c = counters_load(&worker_stats[i].total);
+			worker_interval[i] = counters_sub(c, worker_total[i]);
+			worker_total[i] = c;
+			total.blocks += c.blocks;
+			total.commands += c.commands;
+		}
+		interval = (struct counters) { 0, 0 };
+		memset(device_interval, 0, device_count * sizeof(*device_interval));
+		for (int i = 0; i < opts.parallelism; i++) {
+			interval.blocks += worker_interval[i].blocks;
+			interval.commands += worker_interval[i].commands;
+			struct counters *d = &device_interval[workers[i].device - devices];
+			d->blocks += worker_interval[i].blocks;
+			d->commands += worker_interval[i].commands;
+		}
+		memset(op_total, 0, sizeof(op_total));
+		for (int i = 0; i < opts.parallelism; i++)
+			for (int op = 0; op < STATS_OPS; op++)
+				counters_add(&op_total[op], counters_load(&worker_stats[i].ops[op]));
+		for (int op = 0; op < STATS_OPS; op++) {
+			op_interval[op] = counters_sub(op_total[op], op_prev[op]);
+			op_prev[op] = op_total[op];
+			interval_hist_update(&op_latency[op], LATENCY_OFFSET(op), 1);
+			op_latency_delta[op] = op_latency[op].delta;
+		}
+		interval_hist_update(&latency, LATENCY_OFFSET(0), STATS_OPS);
+		interval_hist_update(&queue_delay, offsetof(struct worker_state, queue_delay), 1);
+		if (opts.enable_pcm) {
+			pcm_get_values(pcm_next);
+			for (int i = 0; i < pcm_count; i++) {
+				// Multiplexed values are estimates which may go down slightly.
+				pcm_deltas[i] = pcm_next[i] > pcm_values[i] ? pcm_next[i] - pcm_values[i] : 0;
+				pcm_values[i] = MAX(pcm_values[i], pcm_next[i]);
+			}
+		}
+		double control_value = 0;
+		if (opts.control.mode != CONTROL_NONE) {
+			for (int i = 0; i < control_counter_count; i++)
+				control_value += pcm_deltas[control_counters[i]];
+			control_value /= seconds;
+			// The drain at the end only gets reported.
+			if (final)
+				controller.error = (opts.control.setpoint - control_value) / opts.control.setpoint;
+			else
+				limit_set_rate(&block_limit, control_update(&controller, control_value, interval.blocks / seconds, seconds));
+		}
+
+		if (output_format != OUTPUT_TEXT) {
+			struct output_record record = {
+				.time = (now - start_time) / 1e9,
+				.interval = seconds,
+				.phase = phase_name(phase.phase),
+				.lba_shift = ssd_features.lba_shift,
+				.total = interval,
+				.workers = opts.parallelism,
+				.worker = worker_interval,
+				// A breakdown for a single device would just repeat the total.
+				.devices = device_count > 1 ? device_count : 0,
+				.device = device_interval,
+				.device_names = device_names,
+				.latency = latency.delta,
+				.queue_delay = queue_delay.delta,
+				.op = op_interval,
+				.op_latency = op_latency_delta,
+				.counter_count = pcm_count,
+				.counter_names = pcm_names,
+				.counter_deltas = pcm_deltas,
+				.control = opts.control.mode != CONTROL_NONE,
+				.control_value = control_value,
+				.control_error = controller.error,
+				.control_rate = controller.rate,
+			};
+			output_record(&record);
+		}
+
+		uint64_t block_rate = interval.blocks / seconds, command_rate = interval.commands / seconds;
+		// Short intervals at the end would make for noisy peaks.
+		if (phase.phase != PHASE_WARMUP && seconds * 2e9 >= interval_ns)
+			peak = MAX(peak, interval.blocks / seconds);
+		printf("%"PRIu64" blocks/s (%"PRIu64" MiB/s)", block_rate, (block_rate << ssd_features.lba_shift) >> 20);
+		// Show command number and estimated size.
+		uint64_t command_size = (command_rate * (sizeof(struct nvme_rw_command) + sizeof(struct nvme_completion))) >> 20;
+		printf(" via %"PRIu64" commands (%"PRIu64" MiB/s)", command_rate, command_size);
+
+		for (int i = 0; i < pcm_count; i++)
+			printf(", %s: %"PRIu64, pcm_names[i], pcm_deltas[i]);
+
+		printf(", ");
+		print_percentiles("latency", latency.delta);
+
+		if (hist_total(queue_delay.delta) > 0) {
+			printf(", ");
+			print_percentiles("queueing", queue_delay.delta);
+			// A growing backlog means the device can't keep up with the schedule.
+			uint64_t lag = 0;
+			for (int i = 0; i < opts.parallelism; i++)
+				lag = MAX(lag, __atomic_load_n(&worker_stats[i].lag, __ATOMIC_RELAXED));
+			if (lag > prev_lag + interval_ns / 10)
+				printf(" (falling behind, %.1f ms late)", lag / 1e6);
+			prev_lag = lag;
+		}
+
+		if (phase.phase == PHASE_WARMUP)
+			printf(" (warm-up)");
+		putchar('\n');
+
+		for (int op = OP_READ; op <= OP_WRITE && op_total[OP_READ].commands && op_total[OP_WRITE].commands; op++) {
+			block_rate = op_interval[op].blocks / seconds;
+			command_rate = op_interval[op].commands / seconds;
+			printf("  %s: %"PRIu64" blocks/s (%"PRIu64" MiB/s) via %"PRIu64" commands, ", op_names[op],
+					block_rate, (block_rate << ssd_features.lba_shift) >> 20, command_rate);
+			print_percentiles("latency", op_latency[op].delta);
+			putchar('\n');
+		}
+
+		if (opts.control.mode != CONTROL_NONE)
+			printf("  control: %s %.0f/s, error %+.1f%%, limit %.0f blocks/s (%.1f MiB/s)\n",
+					opts.control.counter, control_value, controller.error * 100, controller.rate,
+					controller.rate * (1 << ssd_features.lba_shift) / (1 << 20));
+
+		for (int i = 0; device_count > 1 && i < device_count; i++) {
+			block_rate = device_interval[i].blocks / seconds;
+			command_rate = device_interval[i].commands / seconds;
+			printf("  %s: %"PRIu64" blocks/s (%"PRIu64" MiB/s) via %"PRIu64" commands\n", devices[i].path,
+					block_rate, (block_rate << ssd_features.lba_shift) >> 20, command_rate);
+		}
+
+		if (!final && phase_update(&phase, now - start_time, total.commands, interval.blocks / seconds)) {
+			if (phase.phase == PHASE_MEASURE) {
+				printf("Warm-up done after %.3f s, measuring…\n", (now - start_time) / 1e9);
+				// The snapshots were just taken together with the totals.
+				measure_start = now;
+				warmup_total = total;
+				warmup_hist[WARMUP_LATENCY] = *latency.prev_snapshot;
+				warmup_hist[WARMUP_QUEUE_DELAY] = *queue_delay.prev_snapshot;
+				for (int op = 0; op < STATS_OPS; op++)
+					warmup_hist[WARMUP_OP_LATENCY + op] = *op_latency[op].prev_snapshot;
+			} else {
+				steady = (now - measure_start) / 1e9;
+				printf("Steady state after %.3f s (block rate CV %.1f%%)\n", steady, phase.cv * 100);
+				if (opts.phase.stop) {
+					steady_stop = true;
+					request_stop();
+				}
+			}
+		}
+
+		if (!final) continue;
+		if (steady_stop)
+			printf("\nSteady state reached, stopping…\n");
+		else if (interrupted)
+			printf("\nInterrupted, stopping…\n");
+		else if (time_up)
+			printf("\nTime limit reached after %ds, stopping…\n", opts.time_limit);
+		else if (LIMIT_REACHED(global_block_limit))
+			printf("\nBlock limit of %lld reached, stopping…\n", opts.global_block_limit);
+		else if (LIMIT_REACHED(global_command_limit))
+			printf("\nCommand limit of %lld reached, stopping…\n", opts.global_command_limit);
+		else
+			printf("\nPattern finished, stopping…\n");
+		if (phase.phase == PHASE_WARMUP)
+			printf("Stopped during the warm-up, the summary includes it.\n");
+		result->total = counters_sub(total, warmup_total);
+		result->elapsed = (now - measure_start) / 1e9;
+		result->steady = steady;
+		// Without full intervals, the average is the best guess.
+		if (peak == 0 && result->elapsed > 0)
+			peak = result->total.blocks / result->elapsed;
+		result->peak = peak;
+		result->interrupted = interrupted;
+		if (opts.record_path)
+			trace_finish();
+		print_summary(result, warmup_hist);
+	}
+
+	for (int i = 0; i < opts.parallelism; i++) {
+		for (int op = 0; op < STATS_OPS; op++)
+			free(workers[i].latency[op]);
+		free(workers[i].queue_delay);
+		free(workers[i].trace);
+	}
+	free(workers);
+	free(worker_stats);
+	free(pcm_values);
+	free(pcm_deltas);
+	free(pcm_names);
+	free(pcm_next);
+	free(worker_total);
+	free(worker_interval);
+	free(device_interval);
+	free(device_names);
+	interval_hist_free(&latency);
+	interval_hist_free(&queue_delay);
+	for (int op = 0; op < STATS_OPS; op++)
+		interval_hist_free(&op_latency[op]);
+	free(warmup_hist);
+	phase_destroy(&phase);
+}
+
+// Parses the pattern arguments with -b and -s from a sweep point appended,
+// which override earlier ones.
+static void parse_pattern_arguments(int argc, char **argv, const char *buffer_blocks, const char *transfer_size) {
+	char **args = calloc(argc + 5, sizeof(*args));
+	memcpy(args, argv, argc * sizeof(*args));
+	if (buffer_blocks) {
+		args[argc++] = "-b";
+		args[argc++] = (char *) buffer_blocks;
+	}
+	if (transfer_size) {
+		args[argc++] = "-s";
+		args[argc++] = (char *) transfer_size;
 	}
+	pattern->parse_arguments(argc, args);
+	free(args);
+}
 
-	for (;;) {
-		nanosleep(&t, NULL);
+// Sets the options for sweep point `point`.
+static void apply_sweep_point(int point, int pattern_argc, char **pattern_argv) {
+	const struct sweep *sweep = &opts.sweep;
+	const char *buffer_blocks = NULL, *transfer_size = NULL;
+	sweep_point(sweep, point, sweep_point_values);
+	sweep_point_count = sweep->axis_count;
+	printf("\nSweep point %d/%d:", point + 1, sweep_points(sweep));
+	for (int i = 0; i < sweep->axis_count; i++) {
+		const char *value = sweep_point_values[i];
+		sweep_point_names[i] = sweep_param_name(sweep->axes[i].param);
+		printf(" %s=%s", sweep_point_names[i], value);
+		switch (sweep->axes[i].param) {
+		case SWEEP_THREADS:       opts.parallelism = MAX(atoi(value), device_count); break;
+		case SWEEP_QUEUE_DEPTH:   opts.queue_depth = atoi(value); break;
+		case SWEEP_BLOCK_LIMIT:   opts.block_limit = atoll(value); break;
+		case SWEEP_COMMAND_LIMIT: opts.command_limit = atoll(value); break;
+		case SWEEP_BUFFER:        buffer_blocks = value; break;
+		case SWEEP_TRANSFER_SIZE: transfer_size = value; break;
+		case SWEEP_PARAMS:        break;
+		}
+	}
+	putchar('\n');
+	if (buffer_blocks || transfer_size)
+		parse_pattern_arguments(pattern_argc, pattern_argv, buffer_blocks, transfer_size);
+	output_sweep_point(sweep_point_count, sweep_point_names, sweep_point_values,
+			opts.parallelism, device_depth(&devices[0]));
+}
 
-		// Reset the limit and notify all workers.
-		pthread_mutex_lock(&limit_mutex);
-		block_limit = opts.block_limit / res;
-		command_limit = opts.command_limit / res;
-		pthread_cond_broadcast(&limit_cond);
-		pthread_mutex_unlock(&limit_mutex);
+// Prints one line per sweep point.
+static void print_sweep_results(const struct run_result *results, int count) {
+	const struct sweep *sweep = &opts.sweep;
+	const char *values[SWEEP_PARAMS];
+	printf("\nSweep results:\n");
+	for (int i = 0; i < sweep->axis_count; i++)
+		printf("%8s ", sweep_param_name(sweep->axes[i].param));
+	printf("%10s %12s %10s %10s %8s\n", "MiB/s", "commands/s", "p50 us", "p99 us", "steady");
+	for (int point = 0; point < count; point++) {
+		const struct run_result *r = &results[point];
+		sweep_point(sweep, point, values);
+		for (int i = 0; i < sweep->axis_count; i++)
+			printf("%8s ", values[i]);
+		double seconds = r->elapsed > 0 ? r->elapsed : 1;
+		printf("%10.1f %12.0f %10.1f %10.1f ",
+				(r->total.blocks << ssd_features.lba_shift) / seconds / (1 << 20),
+				r->total.commands / seconds, r->latency_p50, r->latency_p99);
+		if (r->steady >= 0)
+			printf("%7.1fs\n", r->steady);
+		else
+			printf("%8s\n", "-");
 	}
 }
 
 static void usage(char *name) {
 	fprintf(stderr, "Usage: %s [options] /dev/nvme0n1 pattern [pattern options]\n", name);
 	fprintf(stderr, "\nOptions:\n");
-	fprintf(stderr, "\t-c mode\tMake sure blocks are cached <once/always> before reading/writing.\n");
+	fprintf(stderr, "\t-c mode\tSet the cache state of blocks <once/always>[:action] before reading/writing:\n");
+	fprintf(stderr, "\t\tload (default), dirty, flush (evict), clean (write back) or nt (non-temporal stores).\n");
 	fprintf(stderr, "\t-j num\tSend commands in parallel on <num> threads.\n");
+	fprintf(stderr, "\t-q num\tKeep <num> commands in flight per thread (default: 1, 64 with -A, the batch size with\n");
+	fprintf(stderr, "\t\tthe nvme custom driver). Uses io_uring unless -e picks a backend.\n");
+	fprintf(stderr, "\t-e name\tSubmit commands via backend <name>[:options]:\n");
+	backend_print_list();
 	fprintf(stderr, "\t-l num\tLimit transfers to <num> blocks/s.\n");
 	fprintf(stderr, "\t-L num\tLimit transfers to <num> commands/s.\n");
-	fprintf(stderr, "\t-r num\tSet limit resolution to 1/<num> s.\n");
-	fprintf(stderr, "\t-t num\tSet execution time to <num> s.\n");
+	fprintf(stderr, "\t-r num\tAllow bursts of 1/<num> s worth of the limit (default: 1000).\n");
+	fprintf(stderr, "\t-t num\tSet execution time to <num> s, not counting the warm-up.\n");
+	fprintf(stderr, "\t-w num\tWarm up for <num> s or <num>c commands without measuring,\n");
+	fprintf(stderr, "\t\tended at the next report.\n");
+	fprintf(stderr, "\t-S spec\tDetect the steady state when the CV of the block rate is below <cv %%>\n");
+	fprintf(stderr, "\t\tover the last intervals: <cv %%>[:<intervals> (default 10)][:stop].\n");
+	fprintf(stderr, "\t-A spec\tRelease commands open-loop, independent of completions:\n");
+	fprintf(stderr, "\t\tconst:<rate>, poisson:<rate> or onoff:<rate>:<period ms>:<duty %%>\n");
+	fprintf(stderr, "\t\twith <rate> in commands/s over all threads. Defaults to a queue depth of 64,\n");
+	fprintf(stderr, "\t\tlatency includes the time late commands waited for submission.\n");
+	fprintf(stderr, "\t-R file\tRecord all commands to <file> for the replay pattern.\n");
+	fprintf(stderr, "\t-N node\tPlace the buffer on NUMA node <node>, the \"device\" node or \"interleave\".\n");
+	fprintf(stderr, "\t-C cpus\tPin threads round-robin to <cpus> like 0-3,8 or to node:<n> or \"device\".\n");
+	fprintf(stderr, "\t-H pages\tBack the buffer with 4k, thp, 2m or 1g pages, add :lock to mlock it.\n");
+	fprintf(stderr, "\t-i num\tReport every <num> ms (default: 1000, minimum: 10).\n");
+	fprintf(stderr, "\t-o fmt\tWrite reports as text, json (lines) or csv to stdout, other output goes to stderr.\n");
+	fprintf(stderr, "\t-D dist\tWrite to SSD blocks with distribution uniform (default), zipf:<theta>\n");
+	fprintf(stderr, "\t\twith 0 < theta < 1 or hotset:<access %%>:<size %%>.\n");
+	fprintf(stderr, "\t-B num\tAlign SSD blocks to multiples of <num> blocks.\n");
+	fprintf(stderr, "\t-p list\tReport [provider:]<comma-separated counters> from provider:\n");
+	pcm_print_providers();
+	fprintf(stderr, "\t-P spec\tAdjust the block limit every interval to hold a counter from -p at a rate:\n");
+	fprintf(stderr, "\t\t<pid|aimd>[,<param>=<value>...]:<setpoint per s>:<counter> with params\n");
+	fprintf(stderr, "\t\tkp, ki, kd (default 0.5, 1, 0) or inc (%% of the start rate), dec (default 5, 0.5).\n");
 	fprintf(stderr, "\t-g num\tStop after <num> blocks.\n");
 	fprintf(stderr, "\t-G num\tStop after <num> commands.\n");
+	fprintf(stderr, "\t-X name=values\tRun once per value, combined with other -X, for -t s each.\n");
+	fprintf(stderr, "\t\tValues are lists of <value> or <from>..<to>[*<factor> (default 2)|+<step>] for\n");
+	sweep_usage();
 	exit(1);
 }
 
@@ -235,15 +1068,37 @@ int main(int argc, char **argv) {
 
 	// Options
 	int opt; // +: Stop parsing arguments when the first non-option is encountered.
-	while ((opt = getopt(argc, argv, "+c:g:G:j:l:L:r:t:p:h")) != -1) {
+	while ((opt = getopt(argc, argv, "+A:B:c:C:D:e:g:G:H:i:j:l:L:N:o:p:P:q:r:R:S:t:w:X:h")) != -1) {
 		switch (opt) {
-		case 'c':
+		case 'A':
+			if (!arrival_parse(&opts.arrival, optarg))
+				usage(argv[0]);
+			break;
+		case 'B':
+			opts.block_dist.granularity = atoll(optarg);
+			if (opts.block_dist.granularity < 1) usage(argv[0]);
+			break;
+		case 'c': {
+			char *action = strchr(optarg, ':');
+			if (action) *action++ = '\0';
 			if (!strcmp(optarg, "once"))
 				opts.cache_once = true;
 			else if (!strcmp(optarg, "always"))
 				opts.cache_always = true;
 			else
 				usage(argv[0]);
+			if (action && !cache_parse_action(action, &opts.cache_action))
+				usage(argv[0]);
+			break;
+		}
+		case 'C':
+			opts.numa_cpus = optarg;
+			break;
+		case 'D':
+			if (!block_dist_parse(&opts.block_dist, optarg)) usage(argv[0]);
+			break;
+		case 'e':
+			opts.backend = optarg;
 			break;
 		case 'g':
 			opts.global_block_limit = atoll(optarg);
@@ -251,6 +1106,14 @@ int main(int argc, char **argv) {
 		case 'G':
 			opts.global_command_limit = atoll(optarg);
 			break;
+		case 'H':
+			if (!buffer_parse(optarg, &opts.buffer))
+				exit(1);
+			break;
+		case 'i':
+			opts.interval_ms = atol(optarg);
+			if (opts.interval_ms < 10) usage(argv[0]);
+			break;
 		case 'j':
 			opts.parallelism = atoi(optarg);
 			break;
@@ -260,46 +1123,122 @@ int main(int argc, char **argv) {
 		case 'L':
 			opts.command_limit = atoll(optarg);
 			break;
+		case 'N':
+			opts.numa_memory = optarg;
+			break;
+		case 'o':
+			if (!output_parse(optarg)) usage(argv[0]);
+			break;
+		case 'q':
+			opts.queue_depth = atoi(optarg);
+			break;
 		case 'r':
 			opts.limit_resolution = atol(optarg);
 			break;
+		case 'R':
+			opts.record_path = optarg;
+			break;
+		case 'S':
+			if (!phase_parse_steady(&opts.phase, optarg)) usage(argv[0]);
+			break;
 		case 't':
 			opts.time_limit = atoi(optarg);
 			break;
+		case 'w':
+			if (!phase_parse_warmup(&opts.phase, optarg)) usage(argv[0]);
+			break;
+		case 'X':
+			if (!sweep_parse(&opts.sweep, optarg)) usage(argv[0]);
+			break;
 		case 'p':
 			pcm_parse_optarg(optarg);
 			opts.enable_pcm = true;
 			break;
+		case 'P':
+			if (!control_parse(&opts.control, optarg)) usage(argv[0]);
+			break;
 		case 'h':
 		default:
 			usage(argv[0]);
 		}
 	}
 
+	// Patterns parse their arguments with getopt as well, which resets optind.
+	const char *device_arg = argv[optind];
+	int pattern_argc = argc - optind - 1;
+	char **pattern_argv = argv + optind + 1;
+	if (opts.sweep.axis_count > 0) {
+		if (!opts.time_limit && !opts.phase.stop) {
+			fprintf(stderr, "Sweeps need -t or -S with stop to end each point.\n");
+			exit(1);
+		}
+		if (opts.record_path) {
+			fprintf(stderr, "Sweeps can't be recorded with -R.\n");
+			exit(1);
+		}
+		// The backend is picked once, so use the largest queue depth.
+		const struct sweep_axis *q = sweep_axis(&opts.sweep, SWEEP_QUEUE_DEPTH);
+		for (int i = 0; q && i < q->count; i++)
+			opts.queue_depth = MAX(opts.queue_depth, atoi(q->values[i]));
+	}
+	output_init();
 	init_random();
-	nvme_open(argv[optind]);
-	get_ssd_features();
+	open_devices(strdup(device_arg));
+	// NUMA placement relative to "device" refers to the first one.
+	const char *device_path = devices[0].path;
 
-	printf("SSD: %s (%s)\n", ssd_features.mn, ssd_features.sn);
-	printf("SSD size: %"PRIu64" blocks (%"PRIu64" GiB)\n", ssd_features.size, (ssd_features.size << ssd_features.lba_shift) >> 30);
-	printf("Block size: %i B\n", 1 << ssd_features.lba_shift);
-	printf("Max block count: %i blocks per command\n", ssd_features.max_block_count);
+	for (int i = 0; i < device_count; i++) {
+		struct ssd_features *f = &devices[i].features;
+		if (device_count > 1)
+			printf("%sDevice %d: %s\n", i > 0 ? "\n" : "", i, devices[i].path);
+		printf("SSD: %s (%s)\n", f->mn, f->sn);
+		printf("SSD size: %"PRIu64" blocks (%"PRIu64" GiB)\n", f->size, (f->size << f->lba_shift) >> 30);
+		printf("Block size: %i B\n", 1 << f->lba_shift);
+		printf("Max block count: %i blocks per command\n", f->max_block_count);
+		printf("Backend: %s\n", devices[i].backend->name);
+		int node = numa_device_node(devices[i].path);
+		if (node >= 0)
+			printf("Device NUMA node: %d\n", node);
+	}
+	if (device_count > 1)
+		putchar('\n');
+	if (opts.parallelism < device_count) {
+		opts.parallelism = device_count;
+		printf("Using %d threads, one per device\n", opts.parallelism);
+	}
+	if (opts.numa_memory && !numa_set_memory_policy(opts.numa_memory, device_path))
+		exit(1);
+	if (opts.numa_cpus && !numa_set_cpus(opts.numa_cpus, device_path))
+		exit(1);
 
 	// Print info about options (useful for analyzing logs).
-	if (opts.cache_once || opts.cache_always)
-		printf("Caching mode: %s\n", opts.cache_once ? "once" : "always");
+	if (opts.cache_once || opts.cache_always) {
+		cache_init(opts.cache_action);
+		printf("Caching mode: %s, %s (%s)\n", opts.cache_once ? "once" : "always",
+				cache_action_name(opts.cache_action), cache_impl_desc());
+	}
 	if (opts.global_block_limit)
 		printf("Global block limit: %lld blocks\n", opts.global_block_limit);
 	if (opts.global_command_limit)
 		printf("Global command limit: %lld commands\n", opts.global_command_limit);
 	if (opts.time_limit)
 		printf("Time limit: %d s\n", opts.time_limit);
+	phase_print(&opts.phase);
+	control_print(&opts.control);
 	if (opts.block_limit)
 		printf("Block limit: %lld blocks/s\n", opts.block_limit);
 	if (opts.command_limit)
 		printf("Command limit: %lld commands/s\n", opts.command_limit);
 	if (opts.limit_resolution)
-		printf("Limit resolution: 1/%ld s\n", opts.limit_resolution);
+		printf("Limit burst: 1/%ld s\n", opts.limit_resolution);
+	arrival_print(&opts.arrival);
+	block_dist_print(&opts.block_dist);
+	numa_print();
+	if (device_depth(&devices[0]) > 1)
+		printf("Queue depth: %u commands per thread\n", device_depth(&devices[0]));
+	if (opts.arrival.process != ARRIVAL_NONE && device_depth(&devices[0]) == 1)
+		fprintf(stderr, "Warning: With a queue depth of 1, -A can't release a command before the previous one\n"
+				"completed. The wait is counted as latency.\n");
 
 	// Get pattern to execute from the dynamic linker.
 	char *pattern_path = get_pattern_path(argv[optind + 1]);
@@ -311,82 +1250,107 @@ int main(int argc, char **argv) {
 		fprintf(stderr, "%s\n", error);
 		exit(1);
 	}
-	if (pattern->parse_arguments != NULL) pattern->parse_arguments(argc - optind - 1, argv + optind + 1);
-	printf("Memory buffer size: %"PRIu64" blocks (%"PRIu64" MiB)\n", pattern->block_count(), (pattern->block_count() << ssd_features.lba_shift) >> 20);
+	if (pattern->parse_arguments != NULL) pattern->parse_arguments(pattern_argc, pattern_argv);
+	uint64_t buffer_blocks = pattern->block_count();
+	const struct sweep_axis *buffer_axis = sweep_axis(&opts.sweep, SWEEP_BUFFER);
+	if ((buffer_axis || sweep_axis(&opts.sweep, SWEEP_TRANSFER_SIZE)) && !pattern->common_options) {
+		fprintf(stderr, "The pattern doesn't take the -b and -s options to sweep.\n");
+		exit(1);
+	}
+	// All sweep points share the largest buffer.
+	for (int i = 0; buffer_axis && i < buffer_axis->count; i++) {
+		parse_pattern_arguments(pattern_argc, pattern_argv, buffer_axis->values[i], NULL);
+		buffer_blocks = MAX(buffer_blocks, pattern->block_count());
+	}
+	printf("Memory buffer size: %"PRIu64" blocks (%"PRIu64" MiB, %s%s)\n", buffer_blocks, (buffer_blocks << ssd_features.lba_shift) >> 20,
+			buffer_page_desc(&opts.buffer), opts.buffer.lock ? ", locked" : "");
 	printf("Pattern loaded: %s\n\n", pattern->desc);
 
-	buffer = aligned_alloc(64, pattern->block_count() << ssd_features.lba_shift);
-	if (buffer == NULL)
-		handle_error("malloc");
+	output_config_str("device", device_arg);
+	output_config_int("devices", device_count);
+	output_config_str("model", ssd_features.mn);
+	output_config_str("serial", ssd_features.sn);
+	output_config_int("device_blocks", ssd_features.size);
+	output_config_int("block_size", 1 << ssd_features.lba_shift);
+	output_config_int("max_block_count", ssd_features.max_block_count);
+	output_config_str("backend", devices[0].backend->name);
+	output_config_str("pattern", pattern_path);
+	output_config_str("pattern_desc", pattern->desc);
+	output_config_int("buffer_blocks", buffer_blocks);
+	output_config_str("buffer_pages", buffer_page_desc(&opts.buffer));
+	output_config_int("threads", opts.parallelism);
+	output_config_int("queue_depth", device_depth(&devices[0]));
+	output_config_int("block_limit", opts.block_limit);
+	output_config_int("command_limit", opts.command_limit);
+	output_config_int("global_block_limit", opts.global_block_limit);
+	output_config_int("global_command_limit", opts.global_command_limit);
+	output_config_int("time_limit", opts.time_limit);
+	output_config_int("warmup_ms", opts.phase.warmup_ns / 1000000);
+	output_config_int("warmup_commands", opts.phase.warmup_commands);
+	output_config_int("interval_ms", opts.interval_ms);
+	if (opts.control.mode != CONTROL_NONE) {
+		output_config_str("control_counter", opts.control.counter);
+		output_config_int("control_setpoint", opts.control.setpoint);
+	}
+	output_config_end();
+
+	// Page alignment satisfies O_DIRECT for all block sizes. The buffer is
+	// faulted in here so that the measurement doesn't include page faults.
+	buffer = buffer_alloc(buffer_blocks << ssd_features.lba_shift, &opts.buffer);
 
-	if (opts.cache_once)
-		put_in_cache(0, pattern->block_count() << ssd_features.lba_shift);
+	if (opts.record_path) {
+		trace_open(opts.record_path, pattern->block_count());
+		printf("Recording commands to %s\n", opts.record_path);
+	}
 
 	if (opts.enable_pcm)
 		pcm_enable();
+	if (opts.control.mode != CONTROL_NONE) {
+		// Per-socket values are summed up.
+		size_t len = strlen(opts.control.counter);
+		int count = opts.enable_pcm ? pcm_get_counter_count() : 0;
+		control_counters = calloc(count, sizeof(*control_counters));
+		for (int i = 0; i < count; i++) {
+			const char *name = pcm_get_counter_name(i);
+			if (!strncmp(name, opts.control.counter, len) && (name[len] == '\0' || name[len] == '@'))
+				control_counters[control_counter_count++] = i;
+		}
+		if (control_counter_count == 0) {
+			fprintf(stderr, "Counter %s for -P is not enabled with -p.\n", opts.control.counter);
+			exit(1);
+		}
+	}
 
-	// Exit normally on interrupts.
+	// Stop gracefully on interrupts and termination requests.
 	struct sigaction sa;
 	sa.sa_handler = signal_handler;
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = 0;
-	if (sigaction(SIGINT, &sa, NULL) == -1)
+	if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1)
+		handle_error("sigaction");
+	// Workers inherit the blocked wake signal, so it stays pending until a
+	// pattern waits for it.
+	sa.sa_handler = wake_handler;
+	sigset_t wake;
+	sigemptyset(&wake);
+	sigaddset(&wake, PATTERN_WAKE_SIGNAL);
+	if (sigaction(PATTERN_WAKE_SIGNAL, &sa, NULL) == -1 || pthread_sigmask(SIG_BLOCK, &wake, NULL) != 0)
 		handle_error("sigaction");
 
-	block_limit = opts.block_limit;
-	command_limit = opts.command_limit;
-	global_block_limit = opts.global_block_limit;
-	global_command_limit = opts.global_command_limit;
-	int time_limit = opts.time_limit;
-
-	struct worker_state workers[opts.parallelism];
-	for (int i = 0; i < opts.parallelism; i++) {
-		init_worker(&workers[i]);
-		pthread_create(&workers[i].thread_id, NULL, run_worker, &workers[i]);
-	}
-	pthread_t limiter_tid;
-	pthread_create(&limiter_tid, NULL, run_limiter, NULL);
-
-	struct timespec t = { .tv_sec = 1, .tv_nsec = 0 };
-	uint64_t block_count, command_count, pcm_value = 0;
-	for (;;) {
-		nanosleep(&t, NULL);
-
-		block_count = 0; command_count = 0;
-		for (int i = 0; i < opts.parallelism; i++) {
-			// XXX: Race condition
-			block_count += workers[i].block_count;
-			command_count += workers[i].command_count;
-			workers[i].block_count = 0;
-			workers[i].command_count = 0;
-		}
-		printf("%"PRIu64" blocks/s (%"PRIu64" MiB/s)", block_count, (block_count << ssd_features.lba_shift) >> 20);
-		// Show command number and estimated size.
-		uint64_t command_size = (command_count * (sizeof(struct nvme_rw_command) + sizeof(struct nvme_completion))) >> 20;
-		printf(" via %"PRIu64" commands (%"PRIu64" MiB/s)", command_count, command_size);
-
-		if (opts.enable_pcm) {
-			uint64_t next = pcm_get_value();
-			printf(", %s: %"PRIu64, pcm_get_counter_name(), next - pcm_value);
-			pcm_value = next;
-		}
-
-		putchar('\n');
-
-		if (opts.time_limit && --time_limit <= 0) {
-			printf("\nTime limit reached after %ds, exiting…\n", opts.time_limit);
-			exit(0);
-		}
-		if (LIMIT_REACHED(global_block_limit)) {
-			printf("\nBlock limit of %lld reached, exiting…\n", opts.global_block_limit);
-			exit(0);
-		}
-		if (LIMIT_REACHED(global_command_limit)) {
-			printf("\nCommand limit of %lld reached, exiting…\n", opts.global_command_limit);
-			exit(0);
-		}
-
+	int points = sweep_points(&opts.sweep);
+	struct run_result *results = calloc(points, sizeof(*results));
+	int completed = 0;
+	for (int point = 0; point < points; point++) {
+		if (opts.sweep.axis_count > 0)
+			apply_sweep_point(point, pattern_argc, pattern_argv);
+		if (opts.cache_once)
+			cache_apply(buffer, pattern->block_count() << ssd_features.lba_shift);
+		run(&results[completed++]);
+		if (results[point].interrupted) break;
 	}
+	if (opts.sweep.axis_count > 0)
+		print_sweep_results(results, completed);
+	free(results);
 
 	dlclose(handle);
 	return 0;
@@ -0,0 +1,206 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For CPU_SET and friends.
+#define _GNU_SOURCE
+
+#include "numa.h"
+
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+
+#define MAX_NODES 1024
+
+static enum {
+	MEMORY_DEFAULT,
+	MEMORY_BIND,
+	MEMORY_INTERLEAVE,
+} memory_policy;
+static int memory_node;
+
+// CPUs workers are pinned to, in order.
+static int *cpus;
+static int cpu_count;
+static char *cpu_desc;
+
+// Reads a single integer from a sysfs file.
+static bool read_sysfs_int(const char *path, int *value) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return false;
+	bool ok = fscanf(f, "%d", value) == 1;
+	fclose(f);
+	return ok;
+}
+
+int numa_device_node(const char *path) {
+	struct stat st;
+	char link[PATH_MAX], dir[PATH_MAX];
+	if (stat(path, &st) < 0) return -1;
+	if (S_ISBLK(st.st_mode))
+		snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(st.st_rdev), minor(st.st_rdev));
+	else if (S_ISCHR(st.st_mode))
+		snprintf(link, sizeof(link), "/sys/dev/char/%u:%u", major(st.st_rdev), minor(st.st_rdev));
+	else
+		// The block device the file lives on.
+		snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(st.st_dev), minor(st.st_dev));
+	if (realpath(link, dir) == NULL) return -1;
+
+	// Walk up towards the PCIe root until a device knows its node.
+	for (char *slash; (slash = strrchr(dir, '/')) != NULL && slash != dir; *slash = '\0') {
+		char file[PATH_MAX + 16];
+		int node;
+		snprintf(file, sizeof(file), "%s/numa_node", dir);
+		if (read_sysfs_int(file, &node) && node >= 0) return node;
+	}
+	return -1;
+}
+
+// Resolves "device" to the node of the device.
+static int parse_node(const char *arg, const char *device_path) {
+	if (strcmp(arg, "device") != 0) {
+		char *end;
+		long node = strtol(arg, &end, 10);
+		return *end == '\0' && node >= 0 && node < MAX_NODES ? node : -1;
+	}
+	int node = numa_device_node(device_path);
+	if (node < 0)
+		fprintf(stderr, "Could not determine the NUMA node of %s.\n", device_path);
+	return node;
+}
+
+bool numa_set_memory_policy(const char *arg, const char *device_path) {
+	if (!strcmp(arg, "interleave")) {
+		memory_policy = MEMORY_INTERLEAVE;
+		return true;
+	}
+	memory_policy = MEMORY_BIND;
+	memory_node = parse_node(arg, device_path);
+	return memory_node >= 0;
+}
+
+// Parses a list like "0-3,8,10-11" with values below `max`, appending them to `values`.
+static bool parse_list(const char *list, int max, int **values, int *count) {
+	char *s = strdup(list), *save;
+	for (char *range = strtok_r(s, ",\n", &save); range; range = strtok_r(NULL, ",\n", &save)) {
+		int first, last;
+		int n = sscanf(range, "%d-%d", &first, &last);
+		if (n == 1) last = first;
+		if (n < 1 || first < 0 || last < first || last >= max) {
+			free(s);
+			return false;
+		}
+		*values = realloc(*values, (*count + last - first + 1) * sizeof(**values));
+		for (int v = first; v <= last; v++)
+			(*values)[(*count)++] = v;
+	}
+	free(s);
+	return *count > 0;
+}
+
+// Reads a list file from sysfs.
+static bool read_sysfs_list(const char *path, char *list, size_t len) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) goto perror;
+	if (fgets(list, len, f) == NULL) goto perror;
+	fclose(f);
+	list[strcspn(list, "\n")] = '\0';
+	return true;
+perror:
+	perror(path);
+	return false;
+}
+
+bool numa_set_cpus(const char *arg, const char *device_path) {
+	if (strcmp(arg, "device") && strncmp(arg, "node:", 5)) {
+		cpu_desc = strdup(arg);
+		return parse_list(arg, CPU_SETSIZE, &cpus, &cpu_count);
+	}
+
+	int node = parse_node(!strcmp(arg, "device") ? arg : arg + 5, device_path);
+	if (node < 0) return false;
+	char path[64], list[4096];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	if (!read_sysfs_list(path, list, sizeof(list))) return false;
+	if (asprintf(&cpu_desc, "%s (node %d)", list, node) < 0) return false;
+	return parse_list(list, CPU_SETSIZE, &cpus, &cpu_count);
+}
+
+void numa_print() {
+	switch (memory_policy) {
+	case MEMORY_DEFAULT:
+		break;
+	case MEMORY_BIND:
+		printf("Buffer NUMA node: %d\n", memory_node);
+		break;
+	case MEMORY_INTERLEAVE:
+		printf("Buffer NUMA node: interleaved\n");
+		break;
+	}
+	if (cpu_count > 0)
+		printf("Worker CPUs: %s\n", cpu_desc);
+}
+
+void numa_bind_memory(void *addr, size_t len) {
+	const int bits = 8 * sizeof(unsigned long);
+	unsigned long mask[MAX_NODES / bits];
+	int mode, *nodes = NULL, node_count = 0;
+	char list[4096];
+	memset(mask, 0, sizeof(mask));
+	switch (memory_policy) {
+	case MEMORY_DEFAULT:
+		return;
+	case MEMORY_BIND:
+		mode = MPOL_BIND;
+		mask[memory_node / bits] = 1ul << (memory_node % bits);
+		break;
+	case MEMORY_INTERLEAVE:
+		mode = MPOL_INTERLEAVE;
+		if (!read_sysfs_list("/sys/devices/system/node/has_memory", list, sizeof(list)) ||
+				!parse_list(list, MAX_NODES, &nodes, &node_count))
+			exit(1);
+		for (int i = 0; i < node_count; i++)
+			mask[nodes[i] / bits] |= 1ul << (nodes[i] % bits);
+		free(nodes);
+		break;
+	default:
+		return;
+	}
+	// No libnuma, so use the system call directly.
+	if (syscall(SYS_mbind, addr, len, mode, mask, MAX_NODES, 0) < 0) {
+		perror("mbind");
+		exit(1);
+	}
+}
+
+void numa_pin_worker(int worker) {
+	if (cpu_count == 0) return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpus[worker % cpu_count], &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+}
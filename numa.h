@@ -0,0 +1,38 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Returns the NUMA node the device (or the device holding the file) at
+// `path` is attached to, or -1 if unknown.
+int numa_device_node(const char *path);
+
+// Sets up buffer placement from -N: a node number, "device" for the node of
+// `device_path` or "interleave". Returns false on errors.
+bool numa_set_memory_policy(const char *arg, const char *device_path);
+// Sets up worker pinning from -C: a CPU list like "0-3,8" or "node:<n>" /
+// "device" for all CPUs of a node. Returns false on errors.
+bool numa_set_cpus(const char *arg, const char *device_path);
+// Prints the chosen placement.
+void numa_print();
+
+// Applies the memory policy to a page-aligned range before it is touched.
+void numa_bind_memory(void *addr, size_t len);
+// Pins the calling worker thread to its CPU from the list.
+void numa_pin_worker(int worker);
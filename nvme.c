@@ -33,12 +33,48 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "linux/nvme.h"
+#include "backend.h"
+#include "timing.h"
 
-static int fd;
-static uint32_t nsid;
+struct nvme_device {
+	int fd;
+	uint32_t nsid;
+	bool custom_driver;
+	// Maximum number of commands per batch and maximum time a batched command
+	// waits for the batch to fill up.
+	unsigned batch_size;
+	uint64_t batch_delay_ns;
+};
 
-#define BATCH_COUNT 1000
-static __thread struct nvme_batch_user_io *batch_io;
+struct nvme_queue {
+	struct nvme_device *dev;
+	// Only used with the custom driver. Batched commands only complete once
+	// the batch has been submitted.
+	struct nvme_batch_user_io *batch_io;
+	uint64_t *batch_user_data;
+	unsigned batched, batch_size;
+	uint64_t batch_start;
+	struct sync_completions *completions;
+};
+
+enum {
+	NVME_BATCH,
+	NVME_DELAY,
+};
+
+static char *const nvme_tokens[] = {
+	[NVME_BATCH] = "batch",
+	[NVME_DELAY] = "delay",
+	NULL
+};
+
+static void nvme_usage() {
+	fprintf(stderr, "NVMe options for the custom driver (comma-separated):\n");
+	fprintf(stderr, "\tbatch=<num>\tSubmit up to <num> commands per ioctl (default 1000). Threads keep this\n");
+	fprintf(stderr, "\t\t\tmany commands in flight unless -q sets a depth, which also caps the batch.\n");
+	fprintf(stderr, "\tdelay=<us>\tSubmit partial batches after <us> (default 100).\n");
+	exit(1);
+}
 
 static const char *nvme_status_to_string(__u32 status)
 {
@@ -90,96 +126,222 @@ static void handle_nvme_error(const char *cmd, int err) {
 }
 
 // Checks whether the NVMe driver supports our custom commands.
-static bool nvme_has_custom_driver() {
-	// Memoize the result.
-	static int result = -1;
-	return result != -1 ? result : (result = ioctl(fd, NVME_IOCTL_SUPPORTS_CUSTOM_CMDS) == 1);
+static bool nvme_has_custom_driver(int fd) {
+	return ioctl(fd, NVME_IOCTL_SUPPORTS_CUSTOM_CMDS) == 1;
 }
 
-// Needs to be called for every thread doing batch IO.
-static void init_batch_io() {
-	batch_io = malloc(sizeof(*batch_io) + BATCH_COUNT * sizeof(batch_io->cmds[0]));
-	batch_io->count = BATCH_COUNT;
+uint32_t nvme_get_nsid(int fd) {
+	return ioctl(fd, NVME_IOCTL_ID);
+}
+
+int nvme_identify(int fd, uint32_t nsid, void *ptr, int cns) {
+	struct nvme_admin_cmd cmd;
+	int err;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = nvme_admin_identify;
+	cmd.nsid = nsid;
+	cmd.addr = (unsigned long)ptr;
+	cmd.data_len = 4096;
+	cmd.cdw10 = cns;
+	err = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+	handle_nvme_error("identify", err);
+	return err;
 }
 
+int nvme_get_features(int fd, uint32_t nsid, struct ssd_features *features) {
+	int err;
+	struct nvme_id_ns ns;
+	struct nvme_id_ctrl ctrl;
+	err = nvme_identify(fd, nsid, &ns, 0);
+	if (err != 0) return err;
+	err = nvme_identify(fd, nsid, &ctrl, 1);
+	if (err != 0) return err;
+
+	memcpy(features->sn, ctrl.sn, 20);
+	features->sn[20] = 0;
+	memcpy(features->mn, ctrl.mn, 40);
+	features->mn[40] = 0;
+	features->size = ns.nsze;
+	features->lba_shift = ns.lbaf[ns.flbas].ds;
+	features->max_block_count = 1 << (ctrl.mdts + 12 - features->lba_shift);
+	return 0;
+}
 
-void nvme_open(const char *dev) {
+static void * nvme_open(const char *path, const char *options) {
+	struct nvme_device *dev = calloc(1, sizeof(*dev));
 	int err;
-	fd = open(dev, O_RDONLY);
-	if (fd < 0)
+	dev->batch_size = 1000;
+	dev->batch_delay_ns = 100000;
+
+	char *opts = strdup(options ? options : ""), *p = opts, *value;
+	while (*p != '\0') {
+		int token = getsubopt(&p, nvme_tokens, &value);
+		if (value == NULL) nvme_usage();
+		switch (token) {
+		case NVME_BATCH: dev->batch_size = atoi(value); break;
+		case NVME_DELAY: dev->batch_delay_ns = atoll(value) * 1000; break;
+		default:         nvme_usage();
+		}
+	}
+	free(opts);
+	if (dev->batch_size < 1) nvme_usage();
+
+	dev->fd = open(path, O_RDONLY);
+	if (dev->fd < 0)
 		goto perror;
 
 	struct stat nvme_stat;
-	err = fstat(fd, &nvme_stat);
+	err = fstat(dev->fd, &nvme_stat);
 	if (err < 0)
 		goto perror;
 	if (!S_ISCHR(nvme_stat.st_mode) && !S_ISBLK(nvme_stat.st_mode)) {
-		fprintf(stderr, "%s is not a block or character device\n", dev);
+		fprintf(stderr, "%s is not a block or character device\n", path);
 		exit(ENODEV);
 	}
-	if (nvme_has_custom_driver()) {
-		fprintf(stderr, "Custom driver commands are available.\n");
+	dev->nsid = nvme_get_nsid(dev->fd);
+	if (dev->nsid == (uint32_t) -1) {
+		fprintf(stderr, "%s is not an NVMe device\n", path);
+		exit(ENODEV);
 	}
-
-	nsid = ioctl(fd, NVME_IOCTL_ID);
-	return;
+	dev->custom_driver = nvme_has_custom_driver(dev->fd);
+	if (dev->custom_driver) {
+		fprintf(stderr, "Custom driver commands are available, batching up to %u commands.\n", dev->batch_size);
+	}
+	return dev;
 perror:
-	perror(dev);
+	perror(path);
 	exit(errno);
 }
 
+static void nvme_backend_identify(void *_dev, struct ssd_features *features) {
+	struct nvme_device *dev = _dev;
+	if (nvme_get_features(dev->fd, dev->nsid, features) != 0) exit(1);
+}
 
-int nvme_identify(void *ptr, int cns) {
-	struct nvme_admin_cmd cmd;
-	int err;
+// Batches can only fill up if there are enough commands in flight.
+static unsigned nvme_default_depth(void *_dev) {
+	struct nvme_device *dev = _dev;
+	return dev->custom_driver ? dev->batch_size : 1;
+}
 
-	memset(&cmd, 0, sizeof(cmd));
-	cmd.opcode = nvme_admin_identify;
-	cmd.nsid = nsid;
-	cmd.addr = (unsigned long)ptr;
-	cmd.data_len = 4096;
-	cmd.cdw10 = cns;
-	err = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
-	handle_nvme_error("identify", err);
-	return err;
+static void * nvme_create_queue(void *dev, unsigned depth) {
+	struct nvme_queue *queue = calloc(1, sizeof(*queue));
+	queue->dev = dev;
+	if (queue->dev->custom_driver) {
+		// A batch can't hold more commands than are in flight.
+		queue->batch_size = MIN(queue->dev->batch_size, depth);
+		queue->batch_io = malloc(sizeof(*queue->batch_io) + queue->batch_size * sizeof(queue->batch_io->cmds[0]));
+		queue->batch_user_data = malloc(queue->batch_size * sizeof(*queue->batch_user_data));
+	}
+	queue->completions = sync_completions_create(depth);
+	return queue;
 }
 
-int nvme_io(int op, void *buffer, __u64 start_block, __u16 block_count) {
-	static __thread int i = 0;
+static void nvme_destroy_queue(void *_queue) {
+	struct nvme_queue *queue = _queue;
+	free(queue->batch_io);
+	free(queue->batch_user_data);
+	free(queue->completions);
+	free(queue);
+}
+
+// Submits the batched commands, which completes them.
+static void nvme_submit_batch(struct nvme_queue *queue) {
+	if (queue->batched == 0) return;
+	queue->batch_io->count = queue->batched;
+	int err = ioctl(queue->dev->fd, NVME_IOCTL_SUBMIT_BATCH_IO, queue->batch_io);
+	handle_nvme_error("batched read/write", err);
+	if (err != 0) exit(1);
+	for (unsigned i = 0; i < queue->batched; i++)
+		sync_completions_add(queue->completions, queue->batch_user_data[i]);
+	queue->batched = 0;
+}
 
+static int nvme_io(struct nvme_queue *queue, const struct io_request *req) {
+	struct nvme_device *dev = queue->dev;
 	struct nvme_user_io io;
 	int err = 0;
 
 	memset(&io, 0, sizeof(io));
 
-	io.opcode  = op;
-	io.slba    = start_block;
-	io.nblocks = block_count;
-	io.addr    = (__u64)buffer;
-
-	if (nvme_has_custom_driver()) {
-		if (!batch_io) init_batch_io();
-		// With the custom driver, we buffer commands for submission to save on
-		// syscalls.
-		batch_io->cmds[i++] = io;
-		if (i == BATCH_COUNT) {
-			err = ioctl(fd, NVME_IOCTL_SUBMIT_BATCH_IO, batch_io);
-			handle_nvme_error("batched read/write", err);
-			i = 0;
-		}
-	} else {
-		err = ioctl(fd, NVME_IOCTL_SUBMIT_IO, &io);
-		handle_nvme_error("read/write", err);
-	}
+	io.opcode  = req->op;
+	io.slba    = req->start_block;
+	io.nblocks = req->block_count;
+	io.addr    = (__u64)req->buffer;
+
+	err = ioctl(dev->fd, NVME_IOCTL_SUBMIT_IO, &io);
+	handle_nvme_error("read/write", err);
 	return err;
 }
 
-int nvme_io_cmd(int op) {
+// With the custom driver, we buffer commands for submission to save on
+// syscalls.
+static void nvme_batch(struct nvme_queue *queue, const struct io_request *req) {
+	if (queue->batched == 0)
+		queue->batch_start = now_ns();
+	struct nvme_user_io *io = &queue->batch_io->cmds[queue->batched];
+	memset(io, 0, sizeof(*io));
+	io->opcode  = req->op;
+	io->slba    = req->start_block;
+	io->nblocks = req->block_count;
+	io->addr    = (__u64)req->buffer;
+	queue->batch_user_data[queue->batched++] = req->user_data;
+	if (queue->batched == queue->batch_size)
+		nvme_submit_batch(queue);
+}
+
+static int nvme_io_cmd(struct nvme_queue *queue, int op) {
 	struct nvme_passthru_cmd cmd;
 	memset(&cmd, 0, sizeof(cmd));
 	cmd.opcode = op;
-	cmd.nsid = nsid;
-	int err = ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+	cmd.nsid = queue->dev->nsid;
+	int err = ioctl(queue->dev->fd, NVME_IOCTL_IO_CMD, &cmd);
 	handle_nvme_error("io cmd", err);
 	return err;
 }
+
+static void nvme_submit(void *_queue, const struct io_request *req) {
+	struct nvme_queue *queue = _queue;
+	int err;
+	if (req->op != OP_FLUSH && queue->batch_io) {
+		nvme_batch(queue, req);
+		return;
+	}
+	// Flushes must not overtake batched writes.
+	if (queue->batch_io)
+		nvme_submit_batch(queue);
+	if (req->op == OP_FLUSH)
+		err = nvme_io_cmd(queue, req->op);
+	else
+		err = nvme_io(queue, req);
+	if (err != 0) exit(1);
+	sync_completions_add(queue->completions, req->user_data);
+}
+
+static void nvme_flush(void *queue) {
+	nvme_submit_batch(queue);
+}
+
+// Submits a partial batch only if the caller waits for it or if it has waited
+// for too long already.
+static unsigned nvme_poll(void *_queue, uint64_t *user_data, unsigned min, unsigned max) {
+	struct nvme_queue *queue = _queue;
+	if (queue->batched > 0 && (queue->completions->count < min ||
+				now_ns() - queue->batch_start >= queue->dev->batch_delay_ns))
+		nvme_submit_batch(queue);
+	return sync_completions_poll(queue->completions, user_data, max);
+}
+
+const struct io_backend nvme_backend = {
+	.name = "nvme",
+	.desc = "Synchronous NVMe ioctls (default for NVMe devices), see -e nvme:help.",
+	.open = nvme_open,
+	.identify = nvme_backend_identify,
+	.create_queue = nvme_create_queue,
+	.destroy_queue = nvme_destroy_queue,
+	.submit = nvme_submit,
+	.flush = nvme_flush,
+	.poll = nvme_poll,
+	.default_depth = nvme_default_depth,
+};
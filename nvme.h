@@ -1,7 +1,12 @@
+#pragma once
+
+#include <stdint.h>
 #include <linux/types.h>
 
-void nvme_open(const char *dev);
+struct ssd_features;
 
-int nvme_identify(void *ptr, int cns);
-int nvme_io(int op, void *buffer, __u64 start_block, __u16 block_count);
-int nvme_io_cmd(int op);
+// Returns the namespace ID or -1 if fd doesn't belong to an NVMe device.
+uint32_t nvme_get_nsid(int fd);
+int nvme_identify(int fd, uint32_t nsid, void *ptr, int cns);
+// Fills in features from the identify data. Returns 0 or an error.
+int nvme_get_features(int fd, uint32_t nsid, struct ssd_features *features);
@@ -0,0 +1,257 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "output.h"
+#include "pattern.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum output_format output_format = OUTPUT_TEXT;
+
+static FILE *out;
+static bool config_started, header_written;
+
+static const double percentiles[] = { 50, 90, 99, 99.9, 100 };
+static const char * const percentile_names[] = { "p50", "p90", "p99", "p99.9", "max" };
+#define PERCENTILE_COUNT (sizeof(percentiles) / sizeof(*percentiles))
+
+bool output_parse(const char *arg) {
+	if (!strcmp(arg, "text"))
+		output_format = OUTPUT_TEXT;
+	else if (!strcmp(arg, "json"))
+		output_format = OUTPUT_JSON;
+	else if (!strcmp(arg, "csv"))
+		output_format = OUTPUT_CSV;
+	else
+		return false;
+	return true;
+}
+
+void output_init() {
+	if (output_format == OUTPUT_TEXT) return;
+	out = fdopen(dup(STDOUT_FILENO), "w");
+	if (out == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		perror("output");
+		exit(1);
+	}
+	setlinebuf(out);
+}
+
+// Writes a JSON string. Our strings don't need more than basic escaping.
+static void json_string(const char *s) {
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', out);
+		if ((unsigned char) *s >= 0x20)
+			fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+static void config_key(const char *key) {
+	if (output_format == OUTPUT_JSON) {
+		fputs(config_started ? ", " : "{\"type\": \"config\", ", out);
+		json_string(key);
+		fputs(": ", out);
+	} else {
+		fprintf(out, "# %s: ", key);
+	}
+	config_started = true;
+}
+
+void output_config_str(const char *key, const char *value) {
+	if (output_format == OUTPUT_TEXT) return;
+	config_key(key);
+	if (output_format == OUTPUT_JSON)
+		json_string(value);
+	else
+		fprintf(out, "%s\n", value);
+}
+
+void output_config_int(const char *key, long long value) {
+	if (output_format == OUTPUT_TEXT) return;
+	config_key(key);
+	fprintf(out, output_format == OUTPUT_JSON ? "%lld" : "%lld\n", value);
+}
+
+void output_config_end() {
+	if (output_format == OUTPUT_JSON && config_started)
+		fputs("}\n", out);
+}
+
+void output_sweep_point(int params, const char * const *names, const char * const *values, int threads, int queue_depth) {
+	if (output_format == OUTPUT_JSON) {
+		fputs("{\"type\": \"point\", \"params\": {", out);
+		for (int i = 0; i < params; i++) {
+			fputs(i ? ", " : "", out);
+			json_string(names[i]);
+			fputs(": ", out);
+			json_string(values[i]);
+		}
+		fprintf(out, "}, \"threads\": %d, \"queue_depth\": %d}\n", threads, queue_depth);
+	} else if (output_format == OUTPUT_CSV) {
+		// The worker and device columns depend on the point.
+		for (int i = 0; i < params; i++)
+			fprintf(out, "# param_%s: %s\n", names[i], values[i]);
+		fprintf(out, "# threads: %d\n# queue_depth: %d\n", threads, queue_depth);
+		header_written = false;
+	}
+}
+
+static void json_percentiles(const char *name, const struct histogram *h) {
+	fprintf(out, ", \"%s_us\": {", name);
+	for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+		fprintf(out, "%s\"%s\": %.1f", i ? ", " : "", percentile_names[i], hist_percentile(h, percentiles[i]) / 1e3);
+	fputc('}', out);
+}
+
+static const char * const op_names[] = { [OP_READ] = "read", [OP_WRITE] = "write" };
+
+static void csv_header(const struct output_record *r) {
+	fputs("time,interval,phase,blocks,bytes,commands", out);
+	for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+		fprintf(out, ",latency_%s_us", percentile_names[i]);
+	for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+		fprintf(out, ",queueing_%s_us", percentile_names[i]);
+	for (int op = OP_READ; op <= OP_WRITE; op++) {
+		fprintf(out, ",%s_blocks,%s_commands", op_names[op], op_names[op]);
+		for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+			fprintf(out, ",%s_latency_%s_us", op_names[op], percentile_names[i]);
+	}
+	for (int i = 0; i < r->counter_count; i++)
+		fprintf(out, ",%s", r->counter_names[i]);
+	if (r->control)
+		fputs(",control_value,control_error,control_rate", out);
+	for (int i = 0; i < r->devices; i++)
+		fprintf(out, ",device%d_blocks,device%d_commands", i, i);
+	for (int i = 0; i < r->workers; i++)
+		fprintf(out, ",worker%d_blocks,worker%d_commands", i, i);
+	fputc('\n', out);
+}
+
+void output_record(const struct output_record *r) {
+	if (output_format == OUTPUT_JSON) {
+		fprintf(out, "{\"type\": \"interval\", \"time\": %.3f, \"interval\": %.3f, \"phase\": \"%s\"",
+				r->time, r->interval, r->phase);
+		fprintf(out, ", \"blocks\": %"PRIu64", \"bytes\": %"PRIu64", \"commands\": %"PRIu64,
+				r->total.blocks, r->total.blocks << r->lba_shift, r->total.commands);
+		json_percentiles("latency", r->latency);
+		if (hist_total(r->queue_delay) > 0)
+			json_percentiles("queueing", r->queue_delay);
+		for (int op = OP_READ; op <= OP_WRITE; op++) {
+			fprintf(out, ", \"%s\": {\"blocks\": %"PRIu64", \"commands\": %"PRIu64, op_names[op],
+					r->op[op].blocks, r->op[op].commands);
+			json_percentiles("latency", r->op_latency[op]);
+			fputc('}', out);
+		}
+		if (r->counter_count > 0) {
+			fputs(", \"counters\": {", out);
+			for (int i = 0; i < r->counter_count; i++) {
+				fputs(i ? ", " : "", out);
+				json_string(r->counter_names[i]);
+				fprintf(out, ": %"PRIu64, r->counter_deltas[i]);
+			}
+			fputc('}', out);
+		}
+		if (r->control)
+			fprintf(out, ", \"control\": {\"value\": %.0f, \"error\": %.4f, \"rate\": %.0f}",
+					r->control_value, r->control_error, r->control_rate);
+		if (r->devices > 0) {
+			fputs(", \"devices\": [", out);
+			for (int i = 0; i < r->devices; i++) {
+				fputs(i ? ", {\"path\": " : "{\"path\": ", out);
+				json_string(r->device_names[i]);
+				fprintf(out, ", \"blocks\": %"PRIu64", \"commands\": %"PRIu64"}", r->device[i].blocks, r->device[i].commands);
+			}
+			fputc(']', out);
+		}
+		fputs(", \"workers\": [", out);
+		for (int i = 0; i < r->workers; i++)
+			fprintf(out, "%s{\"blocks\": %"PRIu64", \"commands\": %"PRIu64"}", i ? ", " : "",
+					r->worker[i].blocks, r->worker[i].commands);
+		fputs("]}\n", out);
+	} else if (output_format == OUTPUT_CSV) {
+		if (!header_written) {
+			csv_header(r);
+			header_written = true;
+		}
+		fprintf(out, "%.3f,%.3f,%s,%"PRIu64",%"PRIu64",%"PRIu64, r->time, r->interval, r->phase,
+				r->total.blocks, r->total.blocks << r->lba_shift, r->total.commands);
+		for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+			fprintf(out, ",%.1f", hist_percentile(r->latency, percentiles[i]) / 1e3);
+		for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+			fprintf(out, ",%.1f", hist_percentile(r->queue_delay, percentiles[i]) / 1e3);
+		for (int op = OP_READ; op <= OP_WRITE; op++) {
+			fprintf(out, ",%"PRIu64",%"PRIu64, r->op[op].blocks, r->op[op].commands);
+			for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+				fprintf(out, ",%.1f", hist_percentile(r->op_latency[op], percentiles[i]) / 1e3);
+		}
+		for (int i = 0; i < r->counter_count; i++)
+			fprintf(out, ",%"PRIu64, r->counter_deltas[i]);
+		if (r->control)
+			fprintf(out, ",%.0f,%.4f,%.0f", r->control_value, r->control_error, r->control_rate);
+		for (int i = 0; i < r->devices; i++)
+			fprintf(out, ",%"PRIu64",%"PRIu64, r->device[i].blocks, r->device[i].commands);
+		for (int i = 0; i < r->workers; i++)
+			fprintf(out, ",%"PRIu64",%"PRIu64, r->worker[i].blocks, r->worker[i].commands);
+		fputc('\n', out);
+	}
+}
+
+void output_summary(const struct output_summary *s) {
+	double average = s->elapsed > 0 ? s->total.blocks / s->elapsed : 0;
+	if (output_format == OUTPUT_JSON) {
+		fprintf(out, "{\"type\": \"summary\", \"elapsed\": %.3f", s->elapsed);
+		if (s->steady >= 0)
+			fprintf(out, ", \"steady\": %.3f", s->steady);
+		if (s->params > 0) {
+			fputs(", \"params\": {", out);
+			for (int i = 0; i < s->params; i++) {
+				fputs(i ? ", " : "", out);
+				json_string(s->param_names[i]);
+				fputs(": ", out);
+				json_string(s->param_values[i]);
+			}
+			fputc('}', out);
+		}
+		fprintf(out, ", \"blocks\": %"PRIu64", \"bytes\": %"PRIu64", \"commands\": %"PRIu64,
+				s->total.blocks, s->total.blocks << s->lba_shift, s->total.commands);
+		fprintf(out, ", \"average_bytes_per_s\": %.0f, \"peak_bytes_per_s\": %.0f",
+				average * (1 << s->lba_shift), s->peak_blocks_per_s * (1 << s->lba_shift));
+		json_percentiles("latency", s->latency);
+		if (hist_total(s->queue_delay) > 0)
+			json_percentiles("queueing", s->queue_delay);
+		fputs("}\n", out);
+	} else if (output_format == OUTPUT_CSV) {
+		// Keep the table intact, the summary goes into trailing comments.
+		for (int i = 0; i < s->params; i++)
+			fprintf(out, "# param_%s: %s\n", s->param_names[i], s->param_values[i]);
+		fprintf(out, "# elapsed: %.3f\n", s->elapsed);
+		if (s->steady >= 0)
+			fprintf(out, "# steady: %.3f\n", s->steady);
+		fprintf(out, "# blocks: %"PRIu64"\n# bytes: %"PRIu64"\n# commands: %"PRIu64"\n",
+				s->total.blocks, s->total.blocks << s->lba_shift, s->total.commands);
+		fprintf(out, "# average_bytes_per_s: %.0f\n# peak_bytes_per_s: %.0f\n",
+				average * (1 << s->lba_shift), s->peak_blocks_per_s * (1 << s->lba_shift));
+		for (unsigned i = 0; i < PERCENTILE_COUNT; i++)
+			fprintf(out, "# latency_%s_us: %.1f\n", percentile_names[i], hist_percentile(s->latency, percentiles[i]) / 1e3);
+	}
+}
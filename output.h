@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "hist.h"
+#include "stats.h"
+
+// Format of the per-interval records written by -o.
+enum output_format {
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_CSV,
+};
+
+extern enum output_format output_format;
+
+// Parses -o: "text", "json" or "csv". Returns false on errors.
+bool output_parse(const char *arg);
+// For machine-readable formats, moves stdout to a separate stream for the
+// records and sends all other (human-readable) output to stderr.
+void output_init();
+
+// Configuration header, written as a single JSON object or CSV comments.
+void output_config_str(const char *key, const char *value);
+void output_config_int(const char *key, long long value);
+void output_config_end();
+
+// Starts a sweep point. The parameters and the thread count and queue depth
+// it runs with precede its records, CSV starts a new table with its own header.
+void output_sweep_point(int params, const char * const *names, const char * const *values, int threads, int queue_depth);
+
+// One reporting interval.
+struct output_record {
+	// Seconds since start and length of the interval.
+	double time, interval;
+	// See phase_name().
+	const char *phase;
+	int lba_shift;
+	struct counters total;
+	int workers;
+	const struct counters *worker;
+	int devices;
+	const struct counters *device;
+	const char * const *device_names;
+	const struct histogram *latency, *queue_delay;
+	// Reads and writes, indexed by OP_*.
+	const struct counters *op;
+	const struct histogram * const *op_latency;
+	int counter_count;
+	const char * const *counter_names;
+	const uint64_t *counter_deltas;
+	// Controlled counter rate, its error relative to the setpoint and the new
+	// block limit, with -P.
+	bool control;
+	double control_value, control_error, control_rate;
+};
+
+void output_record(const struct output_record *r);
+// Totals over the whole run.
+struct output_summary {
+	// Parameters of the sweep point, if any.
+	int params;
+	const char * const *param_names, * const *param_values;
+	// Wall time in seconds from the end of the warm-up until all workers
+	// stopped and when the steady state began, negative if it didn't.
+	double elapsed, steady;
+	int lba_shift;
+	struct counters total;
+	// Highest block rate of a reporting interval.
+	double peak_blocks_per_s;
+	const struct histogram *latency, *queue_delay;
+};
+
+void output_summary(const struct output_summary *s);
@@ -14,12 +14,20 @@
  * limitations under the License.
  */
 
+#pragma once
+
 #include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 #define MIN(x, y) (((x) < (y)) ? (x) : (y))
 
+// Sent to each worker on stop. It is blocked otherwise, so a pattern can wait
+// for the stop by unblocking it in sigsuspend() without missing it.
+#define PATTERN_WAKE_SIGNAL SIGUSR1
+
 enum {
 	// These correspond to the NVMe opcodes. Note that NVMe commands are from
 	// SSD perspective.
@@ -43,6 +51,8 @@ struct cmd {
 	uint16_t block_count;
 	// The target position in memory.
 	size_t target_block;
+	// When to submit the command in ns since the start, 0 for immediately.
+	uint64_t time;
 };
 
 struct pattern {
@@ -50,10 +60,27 @@ struct pattern {
 
 	// Function to parse command line arguments.
 	void (*parse_arguments)(int, char**);
+	// Whether parse_arguments takes the -b and -s options from
+	// common/options.h, which sweeps over b and s pass to it.
+	bool common_options;
 
 	// Returns the size of the memory buffer in blocks.
 	uint64_t (*block_count)();
 
-	// Returns the next thing to do.
+	// Returns the next thing to do. Patterns using this keep global state, so
+	// calls are serialized by a mutex. Only used if next is NULL.
 	struct cmd (*next_cmd)(struct ssd_features*);
+
+	// Creates the state for worker number `worker` out of `workers`. Called by
+	// the worker thread itself. May be NULL if next doesn't need any state.
+	void * (*init)(struct ssd_features*, int worker, int workers);
+	// Returns the next thing to do for the worker owning `state`. Workers
+	// call this concurrently.
+	struct cmd (*next)(void *state, struct ssd_features*);
+	// Fills `out` with up to `n` commands for the worker owning `state`.
+	// Returns the number of commands, 0 if the worker should stop. Saves a
+	// call per command, next is used if NULL.
+	size_t (*next_cmds)(void *state, struct ssd_features*, struct cmd *out, size_t n);
+	// Frees the worker state, may be NULL.
+	void (*destroy)(void *state);
 };
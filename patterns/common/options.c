@@ -21,15 +21,71 @@
 #include <unistd.h>
 
 #include "pattern.h"
+#include "random.h"
 
 static uint64_t block_count = 1000;
 static int operation = OP_WRITE;
+// Percentage of OP_READ commands in 1/100 %, or -1 to always use `operation`.
+static int read_share = -1;
+
+// Transfer sizes from -s: weighted entries, each a fixed size or a range.
+struct size_entry {
+	uint64_t min, max;
+	// Sizes with a K/M/G suffix are in bytes, otherwise in blocks.
+	bool bytes;
+	unsigned weight;
+};
+static struct size_entry *sizes;
+static int size_count;
+static unsigned total_weight;
+static bool sizes_printed;
+
+// Parses a size like "8" (blocks) or "4K" (bytes).
+static bool parse_size(const char *s, uint64_t *size, bool *bytes) {
+	char *end;
+	*size = strtoull(s, &end, 10);
+	*bytes = true;
+	switch (*end) {
+	case 'G': case 'g': *size <<= 10; // fallthrough
+	case 'M': case 'm': *size <<= 10; // fallthrough
+	case 'K': case 'k': *size <<= 10; end++; break;
+	default: *bytes = false;
+	}
+	return *end == '\0' && *size > 0;
+}
+
+// Parses "<size>[-<size>][:<weight>]" entries separated by commas.
+static bool parse_sizes(const char *arg) {
+	char *s = strdup(arg), *save;
+	bool ok = true;
+	for (char *entry = strtok_r(s, ",", &save); ok && entry; entry = strtok_r(NULL, ",", &save)) {
+		struct size_entry e = { .weight = 1 };
+		char *weight = strchr(entry, ':');
+		if (weight) {
+			*weight++ = '\0';
+			e.weight = atoi(weight);
+		}
+		char *max = strchr(entry, '-');
+		if (max) *max++ = '\0';
+		bool max_bytes;
+		ok = parse_size(entry, &e.min, &e.bytes) && e.weight > 0;
+		if (ok && max)
+			ok = parse_size(max, &e.max, &max_bytes) && max_bytes == e.bytes && e.max >= e.min;
+		else
+			e.max = e.min;
+		sizes = realloc(sizes, (size_count + 1) * sizeof(*sizes));
+		sizes[size_count++] = e;
+		total_weight += e.weight;
+	}
+	free(s);
+	return ok && size_count > 0;
+}
 
 // Parses command-line arguments.
 void parse_options(int argc, char **argv) {
 	int opt;
 	optind = 1;
-	while ((opt = getopt(argc, argv, "hb:o:")) != -1) {
+	while ((opt = getopt(argc, argv, "hb:m:o:s:")) != -1) {
 		switch (opt) {
 		case 'b':
 			block_count = atoll(optarg);
@@ -42,13 +98,55 @@ void parse_options(int argc, char **argv) {
 				exit(1);
 			}
 			break;
+		case 'm': {
+			double percent = atof(optarg);
+			if (percent < 0 || percent > 100) {
+				fprintf(stderr, "Invalid option -m %s\n", optarg);
+				exit(1);
+			}
+			read_share = percent * 100 + 0.5;
+			break;
+		}
+		case 's':
+			// The last -s wins.
+			size_count = 0;
+			total_weight = 0;
+			if (!parse_sizes(optarg)) {
+				fprintf(stderr, "Invalid option -s %s\n", optarg);
+				exit(1);
+			}
+			// Sweep points parse the options again and print their own sizes.
+			if (!sizes_printed)
+				printf("Transfer sizes: %s\n", optarg);
+			sizes_printed = true;
+			break;
 		case 'h':
 		default:
-			fprintf(stderr, "Usage: %s -b <buffer size> -o <read/write>\n", argv[0]);
+			fprintf(stderr, "Usage: %s -b <buffer size> -o <read/write> -m <read %%> -s <sizes>\n", argv[0]);
+			fprintf(stderr, "Sizes are in blocks or bytes with K/M/G, as a list of <size>[-<size>][:<weight>],\n");
+			fprintf(stderr, "e.g. 4K:60,128K:30,1M:10 or 4K-1M.\n");
 			exit(1);
 		}
 	}
 }
 
 uint64_t opt_block_count() { return block_count; }
-int opt_operation() { return operation; }
+int opt_operation() {
+	if (read_share < 0) return operation;
+	return (int) get_random_below(10000) < read_share ? OP_READ : OP_WRITE;
+}
+
+bool opt_has_transfer_size() { return size_count > 0; }
+
+uint64_t opt_transfer_size(struct ssd_features *ssd_features, uint64_t max) {
+	const struct size_entry *e = sizes;
+	if (size_count > 1) {
+		unsigned w = get_random_below(total_weight);
+		while (w >= e->weight) w -= (e++)->weight;
+	}
+	uint64_t size = e->min == e->max ? e->min : e->min + get_random_below(e->max - e->min + 1);
+	if (e->bytes) size >>= ssd_features->lba_shift;
+	// Commands can't be larger than the device's MDTS.
+	size = MIN(size, MIN(max, ssd_features->max_block_count));
+	return MAX(size, 1);
+}
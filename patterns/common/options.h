@@ -14,6 +14,13 @@
  * limitations under the License.
  */
 
+#include <stdbool.h>
+
 void parse_options(int argc, char **argv);
 uint64_t opt_block_count();
 int opt_operation();
+// Whether -s was given.
+bool opt_has_transfer_size();
+// Returns a transfer size in blocks (not 0-based) from -s, at least 1 and at
+// most `max` and the device's maximum.
+uint64_t opt_transfer_size(struct ssd_features *ssd_features, uint64_t max);
@@ -15,13 +15,14 @@
  */
 
 #include "pattern.h"
+#include <string.h>
 
 static uint64_t block_count() {
 	return 0;
 }
 
 /* Just send flush commands. */
-static struct cmd next_cmd(struct ssd_features *ssd_features) {
+static struct cmd next(void *state, struct ssd_features *ssd_features) {
 	return (struct cmd) {
 		.op = OP_FLUSH,
 		.block_count = 0,
@@ -29,9 +30,15 @@ static struct cmd next_cmd(struct ssd_features *ssd_features) {
 	};
 }
 
+static size_t next_cmds(void *state, struct ssd_features *ssd_features, struct cmd *out, size_t n) {
+	memset(out, 0, n * sizeof(*out));
+	return n;
+}
+
 struct pattern pattern = {
 	.desc = "Send only flush commands, no data transfer.",
 	.parse_arguments = NULL,
 	.block_count = block_count,
-	.next_cmd = next_cmd
+	.next = next,
+	.next_cmds = next_cmds
 };
@@ -17,22 +17,49 @@
 #include "pattern.h"
 #include "common/options.h"
 
-/* Always write to the full buffer. */
-static struct cmd next_cmd(struct ssd_features *ssd_features) {
-	static uint64_t todo = 0;
+struct state {
+	// Each worker handles its own stripe of the buffer.
+	uint64_t start, count;
+	uint64_t todo;
+};
+
+static void * init(struct ssd_features *ssd_features, int worker, int workers) {
+	struct state *state = calloc(1, sizeof(*state));
 	uint64_t count = opt_block_count();
-	if (todo == 0) todo = count;
+	state->start = count * worker / workers;
+	state->count = count * (worker + 1) / workers - state->start;
+	// More workers than blocks, everyone uses the full buffer.
+	if (state->count == 0) {
+		state->start = 0;
+		state->count = count;
+	}
+	return state;
+}
+
+/* Always write to the full buffer. */
+static struct cmd next(void *_state, struct ssd_features *ssd_features) {
+	struct state *state = _state;
+	if (state->todo == 0) state->todo = state->count;
 
-	size_t target_block = count - todo;
-	if (todo > ssd_features->max_block_count)
-		todo -= ssd_features->max_block_count;
+	size_t target_block = state->start + state->count - state->todo;
+	if (opt_has_transfer_size()) {
+		uint64_t size = opt_transfer_size(ssd_features, state->todo);
+		state->todo -= size;
+		return (struct cmd) {
+			.op = opt_operation(),
+			.block_count = size - 1,
+			.target_block = target_block
+		};
+	}
+	if (state->todo > ssd_features->max_block_count)
+		state->todo -= ssd_features->max_block_count;
 	else
-		todo = 0;
+		state->todo = 0;
 
 	return (struct cmd) {
 		.op = opt_operation(),
 		// XXX: Why is -1 necessary here?
-		.block_count = MIN(todo, ssd_features->max_block_count - 1),
+		.block_count = MIN(state->todo, ssd_features->max_block_count - 1),
 		.target_block = target_block
 	};
 }
@@ -40,6 +67,9 @@ static struct cmd next_cmd(struct ssd_features *ssd_features) {
 struct pattern pattern = {
 	.desc = "Sequentially access as much as possible at once.",
 	.parse_arguments = parse_options,
+	.common_options = true,
 	.block_count = opt_block_count,
-	.next_cmd = next_cmd
+	.init = init,
+	.next = next,
+	.destroy = free
 };
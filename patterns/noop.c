@@ -15,21 +15,24 @@
  */
 
 #include "pattern.h"
-#include <unistd.h>
+#include <signal.h>
 
 static uint64_t block_count() {
 	return 0;
 }
 
-/* Pause the calling thread, preventing it from doing anything. */
-static struct cmd next_cmd(struct ssd_features *ssd_features) {
-	pause();
-	return (struct cmd) {};
+/* Park the calling thread until the run stops, preventing it from doing anything. */
+static size_t next_cmds(void *state, struct ssd_features *ssd_features, struct cmd *out, size_t n) {
+	sigset_t mask;
+	pthread_sigmask(SIG_SETMASK, NULL, &mask);
+	sigdelset(&mask, PATTERN_WAKE_SIGNAL);
+	sigsuspend(&mask);
+	return 0;
 }
 
 struct pattern pattern = {
 	.desc = "Don't do anything.",
 	.parse_arguments = NULL,
 	.block_count = block_count,
-	.next_cmd = next_cmd
+	.next_cmds = next_cmds
 };
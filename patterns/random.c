@@ -18,18 +18,50 @@
 #include "random.h"
 #include "common/options.h"
 
+static void * init(struct ssd_features *ssd_features, int worker, int workers) {
+	struct rng *rng = malloc(sizeof(*rng));
+	rng_init(rng);
+	return rng;
+}
+
 /* Always write to the full buffer. */
-static struct cmd next_cmd(struct ssd_features *ssd_features) {
+static struct cmd next(void *state, struct ssd_features *ssd_features) {
+	uint64_t size = ssd_features->max_block_count;
+	if (opt_has_transfer_size())
+		size = opt_transfer_size(ssd_features, opt_block_count() - 1);
 	return (struct cmd) {
 		.op = opt_operation(),
-		.block_count = ssd_features->max_block_count - 1,
-		.target_block = get_random_block(opt_block_count(), ssd_features->max_block_count - 1)
+		.block_count = size - 1,
+		.target_block = get_random_block(opt_block_count(), size - 1)
 	};
 }
 
+// Like next(), but the invariants are only looked up once per batch and the
+// positions come from the worker's own generator.
+static size_t next_cmds(void *state, struct ssd_features *ssd_features, struct cmd *out, size_t n) {
+	struct rng *rng = state;
+	uint64_t blocks = opt_block_count();
+	bool sized = opt_has_transfer_size();
+	uint64_t size = ssd_features->max_block_count;
+	for (size_t i = 0; i < n; i++) {
+		if (sized)
+			size = opt_transfer_size(ssd_features, blocks - 1);
+		out[i] = (struct cmd) {
+			.op = opt_operation(),
+			.block_count = size - 1,
+			.target_block = rng_below(rng, blocks - (size - 1)),
+		};
+	}
+	return n;
+}
+
 struct pattern pattern = {
 	.desc = "Accesses random disk blocks in large chunks.",
 	.parse_arguments = parse_options,
+	.common_options = true,
 	.block_count = opt_block_count,
-	.next_cmd = next_cmd
+	.init = init,
+	.next = next,
+	.next_cmds = next_cmds,
+	.destroy = free
 };
@@ -0,0 +1,153 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pattern.h"
+#include "trace.h"
+
+// Consumed parts of the trace are dropped from memory in chunks of this size.
+#define RELEASE_CHUNK (64 << 20)
+
+static uint8_t *trace;
+static const struct trace_record *records;
+static uint64_t record_count;
+static uint64_t buffer_blocks;
+static double speed = 1;
+static bool loop = false;
+// Duration of one pass through the trace when looping.
+static uint64_t duration;
+// Next record to hand out, shared by all workers.
+static uint64_t next_record;
+
+static void usage(char *name) {
+	fprintf(stderr, "Usage: %s -f <trace> [-s <speed>] [-l]\n", name);
+	fprintf(stderr, "\t-s speed\tReplay <speed> times as fast as recorded, 0 to ignore timing.\n");
+	fprintf(stderr, "\t-l\t\tLoop the trace forever.\n");
+	exit(1);
+}
+
+static void parse_arguments(int argc, char **argv) {
+	const char *path = NULL;
+	int opt;
+	optind = 1;
+	while ((opt = getopt(argc, argv, "hf:s:l")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'l':
+			loop = true;
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (path == NULL) usage(argv[0]);
+
+	// Map the trace instead of reading it so that huge traces are streamed
+	// from the page cache.
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) goto perror;
+	if (st.st_size < sizeof(struct trace_header)) goto invalid;
+	trace = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (trace == MAP_FAILED) goto perror;
+	close(fd);
+	madvise(trace, st.st_size, MADV_SEQUENTIAL);
+
+	const struct trace_header *header = (const struct trace_header *) trace;
+	if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) || header->version != TRACE_VERSION ||
+			header->record_size != sizeof(struct trace_record) || header->buffer_blocks == 0)
+		goto invalid;
+	records = (const struct trace_record *) (trace + sizeof(*header));
+	record_count = (st.st_size - sizeof(*header)) / sizeof(struct trace_record);
+	buffer_blocks = header->buffer_blocks;
+	if (record_count == 0) goto invalid;
+	// Workers index their statistics by op, so foreign values must not get through.
+	for (uint64_t i = 0; i < record_count; i++) {
+		uint8_t op = records[i].op;
+		if (op != OP_READ && op != OP_WRITE && op != OP_FLUSH) {
+			fprintf(stderr, "%s: record %"PRIu64" has invalid op %u.\n", path, i, op);
+			goto invalid;
+		}
+	}
+	// Only keep what the workers are about to read mapped.
+	madvise(trace, st.st_size, MADV_DONTNEED);
+	duration = records[record_count - 1].time + 1;
+	printf("Trace: %"PRIu64" commands over %.1f s\n", record_count, duration / 1e9);
+	return;
+perror:
+	perror(path);
+	exit(1);
+invalid:
+	fprintf(stderr, "%s is not a valid trace.\n", path);
+	exit(1);
+}
+
+static uint64_t block_count() {
+	return buffer_blocks;
+}
+
+// Drops records that were handed out long ago from the page tables to keep
+// the resident set small. They'll simply be faulted in again when looping.
+static void release(uint64_t from, uint64_t to) {
+	uint64_t first_chunk = (from % record_count) * sizeof(struct trace_record) / RELEASE_CHUNK;
+	uint64_t last_chunk = (to % record_count) * sizeof(struct trace_record) / RELEASE_CHUNK;
+	// Keep one chunk of slack for workers which are still reading.
+	if (last_chunk > first_chunk && last_chunk >= 2)
+		madvise(trace + (last_chunk - 2) * RELEASE_CHUNK, RELEASE_CHUNK, MADV_DONTNEED);
+}
+
+/* Replay a recorded trace. */
+static size_t next_cmds(void *state, struct ssd_features *ssd_features, struct cmd *out, size_t n) {
+	uint64_t first = __atomic_fetch_add(&next_record, n, __ATOMIC_RELAXED);
+	size_t i;
+	for (i = 0; i < n; i++) {
+		uint64_t index = first + i;
+		if (!loop && index >= record_count) break;
+		uint64_t pass = index / record_count;
+		const struct trace_record *r = &records[index % record_count];
+		uint16_t count = MIN(r->block_count, ssd_features->max_block_count - 1);
+		out[i] = (struct cmd) {
+			.op = r->op,
+			.block_count = count,
+			// Stay inside the buffer even with a smaller MDTS.
+			.target_block = MIN(r->target_block, buffer_blocks - MIN(buffer_blocks, count + 1)),
+			.time = speed > 0 ? (r->time + pass * duration) / speed : 0,
+		};
+	}
+	release(first, first + i);
+	return i;
+}
+
+struct pattern pattern = {
+	.desc = "Replays a trace recorded with -R.",
+	.parse_arguments = parse_arguments,
+	.block_count = block_count,
+	.next_cmds = next_cmds
+};
@@ -17,20 +17,45 @@
 #include "pattern.h"
 #include "common/options.h"
 
+struct state {
+	uint64_t current;
+};
+
+static void * init(struct ssd_features *ssd_features, int worker, int workers) {
+	struct state *state = calloc(1, sizeof(*state));
+	// Spread the workers' cursors over the buffer.
+	state->current = opt_block_count() * worker / workers;
+	return state;
+}
+
 /* Sequentially write a single block to memory. */
-struct cmd next_cmd() {
-	static int current = 0;
-	current %= opt_block_count() - 1;
+static struct cmd next(void *_state, struct ssd_features *ssd_features) {
+	struct state *state = _state;
+	if (opt_has_transfer_size()) {
+		uint64_t size = opt_transfer_size(ssd_features, opt_block_count() - 1);
+		if (state->current + size > opt_block_count()) state->current = 0;
+		struct cmd cmd = {
+			.op = opt_operation(),
+			.block_count = size - 1,
+			.target_block = state->current
+		};
+		state->current += size;
+		return cmd;
+	}
+	state->current %= opt_block_count();
 	return (struct cmd) {
 		.op = opt_operation(),
-		.block_count = 1,
-		.target_block = current++
+		.block_count = 0,
+		.target_block = state->current++
 	};
 }
 
 struct pattern pattern = {
 	.desc = "Sequentially access a single block.",
 	.parse_arguments = parse_options,
+	.common_options = true,
 	.block_count = opt_block_count,
-	.next_cmd = next_cmd
+	.init = init,
+	.next = next,
+	.destroy = free
 };
@@ -16,81 +16,23 @@
 
 #include "pcm.h"
 
-#include "intelpcm/intelpcm.h"
-
-#include <dlfcn.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
-#define PCM_OPERATIONS \
-	OP(PCIeRdCur) \
-	OP(PCIeNSRd) \
-	OP(PCIeWiLF) \
-	OP(PCIeItoM) \
-	OP(PCIeNSWr) \
-	OP(PCIeNSWrF) \
-	OP(RFO) \
-	OP(CRd) \
-	OP(DRd) \
-	OP(PRd) \
-	OP(WCiLF) \
-	OP(WCiL) \
-	OP(WiL) \
-	OP(WbMtoI) \
-	OP(WbMtoE) \
-	OP(ItoM) \
-	OP(WB) \
-	OP(AnyOp)
-
-
-#define OP(op) #op,
-static const char* pcm_operation_list[] = {
-	PCM_OPERATIONS
-	NULL
+static const struct counter_provider *providers[] = {
+	&intelpcm_provider,
+	&perf_provider,
+	&software_provider,
+	NULL,
 };
-#undef OP
 
-static pcm_handle_t instance;
-static enum CBoxOpc opcode;
+// Providers with counters, in the order of their values.
+static const struct counter_provider *active[sizeof(providers) / sizeof(*providers)];
+static int active_count;
 static struct timespec start_time;
-static uint32_t tid;
-static enum tracking_mode {
-	hits = 0,
-	misses = 1,
-} tracking_mode;
-
-static enum CBoxOpc str_to_opcode(const char *str) {
-#define OP(op) if (!strncmp(str, #op, sizeof(#op))) return op;
-	PCM_OPERATIONS
-#undef OP
-	return -1;
-}
-
-static const char * opcode_to_str(enum CBoxOpc opcode) {
-	switch (opcode) {
-#define OP(op) case op: return #op;
-	PCM_OPERATIONS
-#undef OP
-	default:
-		return "unknown operation";
-	}
-}
-
-static enum tracking_mode str_to_tracking_mode(const char *str) {
-	if (str != NULL) {
-		if (strcmp(str, "hits") == 0) return hits;
-		if (strcmp(str, "misses") == 0) return misses;
-	}
-	return -1;
-}
-
-static uint32_t str_to_tid(const char *str) {
-	if (str == NULL) return 0;
-	if (strcmp(str, "filtered") == 0) return 0x3E;
-	return -1;
-}
 
 static void exit_handler() {
 	printf("\n\n");
@@ -99,52 +41,68 @@ static void exit_handler() {
 	clock_gettime(CLOCK_MONOTONIC, &end_time);
 	double diff = end_time.tv_sec - start_time.tv_sec + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
 
-	uint64_t counter = pcm_get_value();
-	long double per_second = (long double)counter / diff;
-	printf("%s: %"PRIu64" over %.2fs (%.0Lf per second)\n", pcm_get_counter_name(), counter, diff, per_second);
+	int count = pcm_get_counter_count();
+	uint64_t *values = malloc(count * sizeof(*values));
+	pcm_get_values(values);
+	for (int i = 0; i < count; i++) {
+		long double per_second = (long double)values[i] / diff;
+		printf("%s: %"PRIu64" over %.2fs (%.0Lf per second)\n", pcm_get_counter_name(i), values[i], diff, per_second);
+	}
+	free(values);
 }
 
-void pcm_parse_optarg(const char *_optarg) {
-	char * optarg = strdup(_optarg);
-	char * opcode_str = strtok(optarg, "-");
-	char * tracking_mode_str = strtok(NULL, "-");
-	char * filtered_str = strtok(NULL, "");
-	opcode = str_to_opcode(opcode_str);
-	tracking_mode = str_to_tracking_mode(tracking_mode_str);
-	tid = str_to_tid(filtered_str);
-	if (opcode == -1 || tracking_mode == -1 || tid == -1) {
-		fprintf(stderr, "Error: Invalid option -p %s\n", _optarg);
-		fprintf(stderr, "Valid opcodes are: ");
-		for (const char **p = pcm_operation_list; *p; p++)
-			fprintf(stderr, "%s ", *p);
-		fprintf(stderr, "\n");
-		fprintf(stderr, "Valid suffixes are -hits or -misses, then -filtered (optional).\n");
-		exit(1);
+void pcm_parse_optarg(const char *optarg) {
+	const struct counter_provider *provider = &intelpcm_provider;
+	const char *list = optarg;
+	const char *colon = strchr(optarg, ':');
+	if (colon) {
+		for (const struct counter_provider **p = providers; *p; p++) {
+			if (strlen((*p)->name) == colon - optarg && !strncmp((*p)->name, optarg, colon - optarg)) {
+				provider = *p;
+				list = colon + 1;
+			}
+		}
 	}
+	provider->parse(list);
 
-	void *lib = dlopen("libintelpcm.so", RTLD_NOW | RTLD_GLOBAL);
-	if (lib) {
-		instance = getInstance();
-	} else {
-		fprintf(stderr, "Error: Intel PCM not available. %s\n", dlerror());
-		exit(1);
-	}
+	for (int i = 0; i < active_count; i++)
+		if (active[i] == provider) return;
+	active[active_count++] = provider;
+}
 
-	free(optarg);
+void pcm_print_providers() {
+	for (const struct counter_provider **p = providers; *p; p++)
+		fprintf(stderr, "\t\t%s\t%s\n", (*p)->name, (*p)->desc);
 }
 
 void pcm_enable() {
+	for (int i = 0; i < active_count; i++)
+		active[i]->enable();
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+
 	// Print statistics on exit.
 	atexit(exit_handler);
+}
 
-	programPCIeCounters(instance, opcode, tid, tracking_mode);
-	clock_gettime(CLOCK_MONOTONIC, &start_time);
+int pcm_get_counter_count() {
+	int count = 0;
+	for (int i = 0; i < active_count; i++)
+		count += active[i]->count();
+	return count;
 }
 
-const char * pcm_get_counter_name() {
-	return opcode_to_str(opcode);
+const char * pcm_get_counter_name(int i) {
+	for (int p = 0; p < active_count; p++) {
+		if (i < active[p]->count())
+			return active[p]->counter_name(i);
+		i -= active[p]->count();
+	}
+	return NULL;
 }
 
-uint64_t pcm_get_value() {
-	return getPCIeCounters(instance, 0);
+void pcm_get_values(uint64_t *values) {
+	for (int i = 0; i < active_count; i++) {
+		active[i]->get_values(values);
+		values += active[i]->count();
+	}
 }
@@ -19,10 +19,34 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// A source of hardware or software counters reported every interval.
+struct counter_provider {
+	const char *name;
+	const char *desc;
+
+	// Adds a comma-separated list of counters. Exits on errors.
+	void (*parse)(const char *list);
+	// Starts counting.
+	void (*enable)();
+	// Returns the number of values and their names.
+	int (*count)();
+	const char * (*counter_name)(int i);
+	// Gets the current values, counted since enable().
+	void (*get_values)(uint64_t *values);
+};
+
+extern const struct counter_provider intelpcm_provider, perf_provider, software_provider;
+
+// Adds counters from -p: "[provider:]list", with the Intel PCM provider by
+// default, e.g. "PCIeItoM-misses,WbMtoI-hits,LLC" or "perf:mem-read".
 void pcm_parse_optarg(const char *optarg);
+// Prints the list of providers for usage messages.
+void pcm_print_providers();
 void pcm_enable();
 
-// Returns the name of the counter passed via pcm_parse_optarg().
-const char * pcm_get_counter_name();
-// Returns the current counter value.
-uint64_t pcm_get_value();
+// Returns the number of values of all providers.
+int pcm_get_counter_count();
+// Returns the name of value `i`.
+const char * pcm_get_counter_name(int i);
+// Gets the current values of all providers.
+void pcm_get_values(uint64_t *values);
@@ -0,0 +1,279 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pcm.h"
+
+#include "intelpcm/intelpcm.h"
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "timing.h"
+
+#define PCM_OPERATIONS \
+	OP(PCIeRdCur) \
+	OP(PCIeNSRd) \
+	OP(PCIeWiLF) \
+	OP(PCIeItoM) \
+	OP(PCIeNSWr) \
+	OP(PCIeNSWrF) \
+	OP(RFO) \
+	OP(CRd) \
+	OP(DRd) \
+	OP(PRd) \
+	OP(WCiLF) \
+	OP(WCiL) \
+	OP(WiL) \
+	OP(WbMtoI) \
+	OP(WbMtoE) \
+	OP(ItoM) \
+	OP(WB) \
+	OP(AnyOp)
+
+
+#define OP(op) #op,
+static const char* pcm_operation_list[] = {
+	PCM_OPERATIONS
+	NULL
+};
+#undef OP
+
+static pcm_handle_t instance;
+enum tracking_mode {
+	hits = 0,
+	misses = 1,
+};
+
+// Something that has to be programmed into the CBoxes. Only one of them can
+// be active at a time, so with several we switch between them.
+struct pcm_event {
+	enum {
+		EVENT_PCIE,
+		EVENT_LLC,
+	} kind;
+	enum CBoxOpc opcode;
+	enum tracking_mode tracking_mode;
+	uint32_t tid;
+	char *name;
+	// Counts while the event was active, per socket (and for LLC, lookups
+	// followed by requests).
+	uint64_t *counts;
+	uint64_t active_ns;
+};
+
+static struct pcm_event *events;
+static int event_count;
+static int sockets;
+static int cboxes;
+
+// Length of one multiplexing time slice.
+#define PCM_SLICE_NS 10000000
+
+// Names of the values returned by pcm_get_values().
+static char **counter_names;
+static int counter_count;
+
+// Protects the event counts with multiplexing.
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t enable_time;
+
+static enum CBoxOpc str_to_opcode(const char *str) {
+#define OP(op) if (!strncmp(str, #op, sizeof(#op))) return op;
+	PCM_OPERATIONS
+#undef OP
+	return -1;
+}
+
+static enum tracking_mode str_to_tracking_mode(const char *str) {
+	if (str != NULL) {
+		if (strcmp(str, "hits") == 0) return hits;
+		if (strcmp(str, "misses") == 0) return misses;
+	}
+	return -1;
+}
+
+static uint32_t str_to_tid(const char *str) {
+	if (str == NULL) return 0;
+	if (strcmp(str, "filtered") == 0) return 0x3E;
+	return -1;
+}
+
+// Values per socket of an event.
+static int event_values(const struct pcm_event *event) {
+	return event->kind == EVENT_LLC ? 2 : 1;
+}
+
+static void parse_counter(const char *spec) {
+	struct pcm_event event = { .name = strdup(spec) };
+	if (!strcmp(spec, "LLC")) {
+		event.kind = EVENT_LLC;
+	} else {
+		char *s = strdup(spec);
+		char *opcode_str = strtok(s, "-");
+		char *tracking_mode_str = strtok(NULL, "-");
+		char *filtered_str = strtok(NULL, "");
+		event.kind = EVENT_PCIE;
+		event.opcode = str_to_opcode(opcode_str);
+		event.tracking_mode = str_to_tracking_mode(tracking_mode_str);
+		event.tid = str_to_tid(filtered_str);
+		free(s);
+		if (event.opcode == -1 || event.tracking_mode == -1 || event.tid == -1) {
+			fprintf(stderr, "Error: Invalid option -p %s\n", spec);
+			fprintf(stderr, "Valid opcodes are: ");
+			for (const char **p = pcm_operation_list; *p; p++)
+				fprintf(stderr, "%s ", *p);
+			fprintf(stderr, "\n");
+			fprintf(stderr, "Valid suffixes are -hits or -misses, then -filtered (optional).\n");
+			fprintf(stderr, "Use LLC for last level cache lookups and requests.\n");
+			exit(1);
+		}
+	}
+	events = realloc(events, (event_count + 1) * sizeof(*events));
+	events[event_count++] = event;
+}
+
+static void intel_parse(const char *_optarg) {
+	char *optarg = strdup(_optarg), *save;
+	for (char *spec = strtok_r(optarg, ",", &save); spec; spec = strtok_r(NULL, ",", &save))
+		parse_counter(spec);
+	free(optarg);
+
+	if (instance) return;
+	void *lib = dlopen("libintelpcm.so", RTLD_NOW | RTLD_GLOBAL);
+	if (lib) {
+		instance = getInstance();
+	} else {
+		fprintf(stderr, "Error: Intel PCM not available. %s\n", dlerror());
+		exit(1);
+	}
+}
+
+// Programs the CBoxes for `event`, which also resets the counters.
+static void program(const struct pcm_event *event) {
+	if (event->kind == EVENT_LLC)
+		programLLCCounters(instance);
+	else
+		programPCIeCounters(instance, event->opcode, event->tid, event->tracking_mode);
+}
+
+// Reads the counters of `event` since it was programmed.
+static void read_event(const struct pcm_event *event, int socket, uint64_t *values) {
+	if (event->kind == EVENT_LLC) {
+		struct LLCCounters llc = getLLCCounterState(instance, socket);
+		values[0] = values[1] = 0;
+		for (int i = 0; i < cboxes && i < 18; i++) {
+			values[0] += llc.lookups[i];
+			values[1] += llc.requests[i];
+		}
+	} else {
+		values[0] = getPCIeCounters(instance, socket);
+	}
+}
+
+// Switches between the events, accumulating what they counted while active.
+static void *multiplex(void *arg) {
+	uint64_t slice_start = now_ns();
+	uint64_t values[2];
+	for (int e = 0;; e = (e + 1) % event_count) {
+		struct pcm_event *event = &events[e];
+		program(event);
+		sleep_until_ns(slice_start + PCM_SLICE_NS);
+		pthread_mutex_lock(&mutex);
+		for (int s = 0; s < sockets; s++) {
+			read_event(event, s, values);
+			for (int v = 0; v < event_values(event); v++)
+				event->counts[s * event_values(event) + v] += values[v];
+		}
+		uint64_t now = now_ns();
+		event->active_ns += now - slice_start;
+		slice_start = now;
+		pthread_mutex_unlock(&mutex);
+	}
+	return NULL;
+}
+
+static void intel_enable() {
+	sockets = getNumSockets(instance);
+	cboxes = getMaxNumOfCBoxes(instance);
+	for (int e = 0; e < event_count; e++) {
+		struct pcm_event *event = &events[e];
+		event->counts = calloc(sockets * event_values(event), sizeof(*event->counts));
+		for (int s = 0; s < sockets; s++) {
+			for (int v = 0; v < event_values(event); v++) {
+				const char *suffix = event->kind == EVENT_LLC ? (v ? "-requests" : "-lookups") : "";
+				char *name = malloc(strlen(event->name) + strlen(suffix) + 16);
+				// Keep the old name for the common single socket case.
+				if (sockets > 1)
+					sprintf(name, "%s%s@%d", event->name, suffix, s);
+				else
+					sprintf(name, "%s%s", event->name, suffix);
+				counter_names = realloc(counter_names, (counter_count + 1) * sizeof(*counter_names));
+				counter_names[counter_count++] = name;
+			}
+		}
+	}
+
+	enable_time = now_ns();
+	if (event_count == 1) {
+		program(&events[0]);
+	} else {
+		pthread_t thread;
+		pthread_create(&thread, NULL, multiplex, NULL);
+	}
+}
+
+static int intel_count() {
+	return counter_count;
+}
+
+static const char * intel_counter_name(int i) {
+	return counter_names[i];
+}
+
+static void intel_get_values(uint64_t *values) {
+	uint64_t v[2];
+	if (event_count == 1) {
+		struct pcm_event *event = &events[0];
+		for (int s = 0; s < sockets; s++) {
+			read_event(event, s, v);
+			for (int i = 0; i < event_values(event); i++)
+				*values++ = v[i];
+		}
+		return;
+	}
+	// Scale up to the whole time. The active slice isn't included, so the
+	// values are estimates that lag behind by up to one round.
+	pthread_mutex_lock(&mutex);
+	uint64_t elapsed = now_ns() - enable_time;
+	for (int e = 0; e < event_count; e++) {
+		struct pcm_event *event = &events[e];
+		for (int i = 0; i < sockets * event_values(event); i++)
+			*values++ = event->active_ns ? (long double) event->counts[i] * elapsed / event->active_ns : 0;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+const struct counter_provider intelpcm_provider = {
+	.name = "intel",
+	.desc = "Intel PCM CBox events like PCIeItoM-misses[-filtered] and LLC (default).",
+	.parse = intel_parse,
+	.enable = intel_enable,
+	.count = intel_count,
+	.counter_name = intel_counter_name,
+	.get_values = intel_get_values,
+};
@@ -0,0 +1,336 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For strchrnul.
+#define _GNU_SOURCE
+
+#include "pcm.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+// Counters from perf_event, which works for uncore PMUs of Intel and AMD
+// CPUs without Intel PCM. Counters are "<pmu>/<event or terms>/" like with
+// perf, where <pmu> without the instance suffix counts all instances (e.g.
+// all uncore_imc_N), or one of the aliases below.
+#define PMU_DIR "/sys/bus/event_source/devices"
+
+// Aliases may have several specs, the first one with an existing PMU is used.
+static const struct {
+	const char *name, *spec;
+	// Factor on top of the sysfs scale.
+	double scale;
+} aliases[] = {
+	// Memory controllers, in bytes. Intel's events have a sysfs scale, AMD's
+	// (Zen 4 and later) count 64-byte CAS commands.
+	{ "mem-read", "uncore_imc/cas_count_read/", 1 },
+	{ "mem-read", "amd_umc/event=0x0a,rdwrmask=0x1/", 64 },
+	{ "mem-write", "uncore_imc/cas_count_write/", 1 },
+	{ "mem-write", "amd_umc/event=0x0a,rdwrmask=0x2/", 64 },
+	// System-wide LLC misses, generic for all vendors.
+	{ "llc-misses", NULL, 1 },
+};
+#define ALIAS_COUNT (sizeof(aliases) / sizeof(*aliases))
+
+struct perf_counter {
+	char *name;
+	// Attributes differ between PMU instances, so keep one per instance.
+	struct perf_event_attr *attrs;
+	char **pmus;
+	int pmu_count;
+	double scale;
+	int *fds;
+	int fd_count;
+};
+
+static struct perf_counter *counters;
+static int counter_count;
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+	return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+// Reads the first line of a PMU file, returns false if it doesn't exist.
+static bool read_pmu_file(const char *pmu, const char *file, char *buf, size_t len) {
+	char path[512];
+	snprintf(path, sizeof(path), PMU_DIR "/%s/%s", pmu, file);
+	FILE *f = fopen(path, "r");
+	if (f == NULL) return false;
+	bool ok = fgets(buf, len, f) != NULL;
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return ok;
+}
+
+// Sets the bits of a format term like "config:8-15" to `value`.
+static bool set_term(struct perf_event_attr *attr, const char *pmu, const char *term, uint64_t value) {
+	char path[256], format[128];
+	snprintf(path, sizeof(path), "format/%s", term);
+	if (!read_pmu_file(pmu, path, format, sizeof(format))) return false;
+	char *bits = strchr(format, ':');
+	if (bits == NULL) return false;
+	*bits++ = '\0';
+	__u64 *config = !strcmp(format, "config1") ? &attr->config1 : !strcmp(format, "config2") ? &attr->config2 : &attr->config;
+	// Bits may be split over several ranges, e.g. "0-7,21".
+	for (char *range = strtok(bits, ","); range; range = strtok(NULL, ",")) {
+		int first, last;
+		if (sscanf(range, "%d-%d", &first, &last) != 2) last = first = atoi(range);
+		int width = last - first + 1;
+		uint64_t mask = width == 64 ? ~0ull : (1ull << width) - 1;
+		*config |= (value & mask) << first;
+		value >>= width;
+	}
+	return true;
+}
+
+// Applies terms like "event=0x04,umask=0x03" or an event name from sysfs.
+static bool parse_terms(struct perf_event_attr *attr, const char *pmu, const char *terms, double *scale) {
+	char buf[512], unit[32];
+	char path[256];
+	if (strchr(terms, '=') == NULL) {
+		snprintf(path, sizeof(path), "events/%s", terms);
+		if (!read_pmu_file(pmu, path, buf, sizeof(buf))) return false;
+		snprintf(path, sizeof(path), "events/%s.scale", terms);
+		char scale_str[64];
+		if (read_pmu_file(pmu, path, scale_str, sizeof(scale_str)))
+			*scale = atof(scale_str);
+		// Report bandwidth events in bytes rather than fractional MiB.
+		snprintf(path, sizeof(path), "events/%s.unit", terms);
+		if (read_pmu_file(pmu, path, unit, sizeof(unit)) && !strcmp(unit, "MiB"))
+			*scale *= 1 << 20;
+		terms = buf;
+	}
+	char *s = strdup(terms), *save;
+	bool ok = true;
+	for (char *term = strtok_r(s, ",", &save); ok && term; term = strtok_r(NULL, ",", &save)) {
+		char *value = strchr(term, '=');
+		if (value) *value++ = '\0';
+		ok = set_term(attr, pmu, term, value ? strtoull(value, NULL, 0) : 1);
+	}
+	free(s);
+	return ok;
+}
+
+// Finds the PMUs called `name` or `name`_<instance number>, but not other
+// PMUs sharing the prefix like uncore_imc_free_running_0.
+static void find_pmus(struct perf_counter *c, const char *name) {
+	DIR *dir = opendir(PMU_DIR);
+	if (dir == NULL) return;
+	size_t len = strlen(name);
+	for (struct dirent *d; (d = readdir(dir)) != NULL;) {
+		const char *suffix = d->d_name + len;
+		if (strncmp(d->d_name, name, len))
+			continue;
+		if (*suffix != '\0' && (*suffix != '_' || suffix[1] == '\0' || suffix[1 + strspn(suffix + 1, "0123456789")] != '\0'))
+			continue;
+		c->pmus = realloc(c->pmus, (c->pmu_count + 1) * sizeof(*c->pmus));
+		c->pmus[c->pmu_count++] = strdup(d->d_name);
+	}
+	closedir(dir);
+}
+
+// Returns whether the PMU of `spec` exists.
+static bool pmu_available(const char *spec) {
+	const char *slash = strchr(spec, '/');
+	if (slash == NULL) return false;
+	char *pmu = strndup(spec, slash - spec);
+	struct perf_counter c = { 0 };
+	find_pmus(&c, pmu);
+	for (int i = 0; i < c.pmu_count; i++)
+		free(c.pmus[i]);
+	free(c.pmus);
+	free(pmu);
+	return c.pmu_count > 0;
+}
+
+static void parse_counter(const char *name, const char *spec, double alias_scale) {
+	struct perf_counter c = { .name = strdup(name), .scale = alias_scale };
+	if (spec == NULL) {
+		// Generic hardware event, no PMU from sysfs.
+		c.pmu_count = 1;
+		c.pmus = calloc(1, sizeof(*c.pmus));
+		c.attrs = calloc(1, sizeof(*c.attrs));
+		c.attrs->type = PERF_TYPE_HARDWARE;
+		c.attrs->config = PERF_COUNT_HW_CACHE_MISSES;
+		goto add;
+	}
+
+	const char *slash = strchr(spec, '/');
+	if (slash == NULL) goto invalid;
+	char *pmu = strndup(spec, slash - spec);
+	char *terms = strdup(slash + 1);
+	size_t len = strlen(terms);
+	if (len > 0 && terms[len - 1] == '/') terms[len - 1] = '\0';
+	find_pmus(&c, pmu);
+	if (c.pmu_count == 0) {
+		fprintf(stderr, "Error: No PMU %s in " PMU_DIR "\n", pmu);
+		exit(1);
+	}
+	c.attrs = calloc(c.pmu_count, sizeof(*c.attrs));
+	for (int i = 0; i < c.pmu_count; i++) {
+		char type[32];
+		// The scale is the same for all instances.
+		double scale = 1;
+		struct perf_event_attr *attr = &c.attrs[i];
+		if (!read_pmu_file(c.pmus[i], "type", type, sizeof(type)) || !parse_terms(attr, c.pmus[i], terms, &scale))
+			goto invalid;
+		attr->type = atoi(type);
+		c.scale = scale * alias_scale;
+	}
+	free(pmu);
+	free(terms);
+add:
+	counters = realloc(counters, (counter_count + 1) * sizeof(*counters));
+	counters[counter_count++] = c;
+	return;
+invalid:
+	fprintf(stderr, "Error: Invalid perf counter %s\n", spec);
+	exit(1);
+}
+
+static void perf_parse(const char *list) {
+	// Terms inside slashes may contain commas.
+	for (const char *p = list; *p;) {
+		const char *end = strchrnul(p, ',');
+		const char *slash = memchr(p, '/', end - p);
+		if (slash) {
+			const char *close = strchr(slash + 1, '/');
+			if (close) end = strchrnul(close, ',');
+		}
+		char *spec = strndup(p, end - p);
+		const char *alias_spec = spec;
+		double alias_scale = 1;
+		bool alias = false, found = false;
+		for (unsigned i = 0; i < ALIAS_COUNT && !found; i++) {
+			if (strcmp(spec, aliases[i].name)) continue;
+			alias = true;
+			if (aliases[i].spec == NULL || pmu_available(aliases[i].spec)) {
+				alias_spec = aliases[i].spec;
+				alias_scale = aliases[i].scale;
+				found = true;
+			}
+		}
+		if (alias && !found) {
+			fprintf(stderr, "Error: perf counter %s is not supported on this CPU, it needs one of the PMUs:", spec);
+			for (unsigned i = 0; i < ALIAS_COUNT; i++)
+				if (!strcmp(spec, aliases[i].name))
+					fprintf(stderr, " %.*s", (int) strcspn(aliases[i].spec, "/"), aliases[i].spec);
+			fprintf(stderr, "\n");
+			exit(1);
+		}
+		if (!alias && strchr(spec, '/') == NULL) {
+			fprintf(stderr, "Error: Invalid perf counter %s, use <pmu>/<event>/ or one of: ", spec);
+			for (unsigned i = 0; i < ALIAS_COUNT; i++)
+				if (i == 0 || strcmp(aliases[i].name, aliases[i - 1].name))
+					fprintf(stderr, "%s ", aliases[i].name);
+			fprintf(stderr, "\n");
+			exit(1);
+		}
+		parse_counter(spec, alias_spec, alias_scale);
+		free(spec);
+		p = *end ? end + 1 : end;
+	}
+}
+
+// Returns the CPUs to open a PMU on: its cpumask for uncore PMUs, otherwise
+// all online CPUs for system-wide counting.
+static int *pmu_cpus(const char *pmu, int *count) {
+	char list[4096];
+	if (pmu == NULL || !read_pmu_file(pmu, "cpumask", list, sizeof(list))) {
+		FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+		if (f == NULL || fgets(list, sizeof(list), f) == NULL) {
+			perror("/sys/devices/system/cpu/online");
+			exit(1);
+		}
+		fclose(f);
+	}
+	int *cpus = NULL;
+	*count = 0;
+	for (char *range = strtok(list, ",\n"); range; range = strtok(NULL, ",\n")) {
+		int first, last;
+		if (sscanf(range, "%d-%d", &first, &last) != 2) last = first = atoi(range);
+		cpus = realloc(cpus, (*count + last - first + 1) * sizeof(*cpus));
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus[(*count)++] = cpu;
+	}
+	return cpus;
+}
+
+static void perf_enable() {
+	for (int i = 0; i < counter_count; i++) {
+		struct perf_counter *c = &counters[i];
+		for (int p = 0; p < c->pmu_count; p++) {
+			int cpu_count;
+			int *cpus = pmu_cpus(c->pmus[p], &cpu_count);
+			struct perf_event_attr *attr = &c->attrs[p];
+			attr->size = sizeof(*attr);
+			// The kernel multiplexes if there are too few counters, so scale
+			// by the time the event was actually counting.
+			attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			c->fds = realloc(c->fds, (c->fd_count + cpu_count) * sizeof(*c->fds));
+			for (int j = 0; j < cpu_count; j++) {
+				int fd = perf_event_open(attr, -1, cpus[j], -1, 0);
+				if (fd < 0) {
+					fprintf(stderr, "perf_event_open %s on CPU %d: %s\n", c->name, cpus[j], strerror(errno));
+					if (errno == EACCES || errno == EPERM)
+						fprintf(stderr, "System-wide counting needs root, CAP_PERFMON or kernel.perf_event_paranoid <= 0.\n");
+					exit(1);
+				}
+				c->fds[c->fd_count++] = fd;
+			}
+			free(cpus);
+		}
+	}
+}
+
+static int perf_count() {
+	return counter_count;
+}
+
+static const char * perf_counter_name(int i) {
+	return counters[i].name;
+}
+
+static void perf_get_values(uint64_t *values) {
+	for (int i = 0; i < counter_count; i++) {
+		struct perf_counter *c = &counters[i];
+		long double sum = 0;
+		for (int j = 0; j < c->fd_count; j++) {
+			uint64_t v[3];
+			if (read(c->fds[j], v, sizeof(v)) != sizeof(v)) continue;
+			if (v[2] > 0)
+				sum += (long double) v[0] * v[1] / v[2];
+		}
+		values[i] = sum * c->scale;
+	}
+}
+
+const struct counter_provider perf_provider = {
+	.name = "perf",
+	.desc = "perf_event PMUs: mem-read, mem-write, llc-misses or <pmu>/<event or terms>/.",
+	.parse = perf_parse,
+	.enable = perf_enable,
+	.count = perf_count,
+	.counter_name = perf_counter_name,
+	.get_values = perf_get_values,
+};
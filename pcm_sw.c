@@ -0,0 +1,154 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pcm.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// Counters the kernel keeps anyway, so they work without privileges, also
+// in VMs and containers: system-wide /proc/vmstat fields and our rusage.
+struct sw_counter {
+	enum {
+		SW_VMSTAT,
+		SW_RUSAGE,
+	} source;
+	// vmstat field or rusage field.
+	char *field;
+	char *name;
+	uint64_t start;
+};
+
+static struct sw_counter *counters;
+static int counter_count;
+
+static const char *rusage_fields[] = {
+	"minflt", "majflt", "nvcsw", "nivcsw", "inblock", "oublock", "utime_us", "stime_us", NULL,
+};
+
+static uint64_t read_rusage(const char *field) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	if (!strcmp(field, "minflt")) return ru.ru_minflt;
+	if (!strcmp(field, "majflt")) return ru.ru_majflt;
+	if (!strcmp(field, "nvcsw")) return ru.ru_nvcsw;
+	if (!strcmp(field, "nivcsw")) return ru.ru_nivcsw;
+	if (!strcmp(field, "inblock")) return ru.ru_inblock;
+	if (!strcmp(field, "oublock")) return ru.ru_oublock;
+	if (!strcmp(field, "utime_us")) return ru.ru_utime.tv_sec * 1000000ull + ru.ru_utime.tv_usec;
+	return ru.ru_stime.tv_sec * 1000000ull + ru.ru_stime.tv_usec;
+}
+
+// Reads all vmstat counters at once, filling in values[i] for the vmstat
+// counters. Returns false if a field doesn't exist.
+static bool read_vmstat(uint64_t *values) {
+	FILE *f = fopen("/proc/vmstat", "r");
+	if (f == NULL) {
+		perror("/proc/vmstat");
+		exit(1);
+	}
+	char key[64];
+	uint64_t value;
+	int found = 0, wanted = 0;
+	for (int i = 0; i < counter_count; i++)
+		wanted += counters[i].source == SW_VMSTAT;
+	while (fscanf(f, "%63s %"SCNu64, key, &value) == 2) {
+		for (int i = 0; i < counter_count; i++) {
+			if (counters[i].source == SW_VMSTAT && !strcmp(counters[i].field, key)) {
+				values[i] = value;
+				found++;
+			}
+		}
+	}
+	fclose(f);
+	return found == wanted;
+}
+
+static void read_all(uint64_t *values) {
+	bool vmstat = false;
+	for (int i = 0; i < counter_count; i++) {
+		if (counters[i].source == SW_RUSAGE)
+			values[i] = read_rusage(counters[i].field);
+		else
+			vmstat = true;
+	}
+	if (vmstat && !read_vmstat(values)) {
+		fprintf(stderr, "Error: Unknown /proc/vmstat field in -p sw:\n");
+		exit(1);
+	}
+}
+
+static void sw_parse(const char *list) {
+	char *s = strdup(list), *save;
+	for (char *spec = strtok_r(s, ",", &save); spec; spec = strtok_r(NULL, ",", &save)) {
+		struct sw_counter c = { .name = strdup(spec) };
+		if (!strncmp(spec, "rusage/", 7)) {
+			c.source = SW_RUSAGE;
+			c.field = strdup(spec + 7);
+			bool known = false;
+			for (const char **f = rusage_fields; *f; f++)
+				known |= !strcmp(*f, c.field);
+			if (!known) {
+				fprintf(stderr, "Error: Unknown rusage field %s, valid are: ", c.field);
+				for (const char **f = rusage_fields; *f; f++)
+					fprintf(stderr, "%s ", *f);
+				fprintf(stderr, "\n");
+				exit(1);
+			}
+		} else {
+			c.source = SW_VMSTAT;
+			c.field = strdup(!strncmp(spec, "vmstat/", 7) ? spec + 7 : spec);
+		}
+		counters = realloc(counters, (counter_count + 1) * sizeof(*counters));
+		counters[counter_count++] = c;
+	}
+	free(s);
+}
+
+static void sw_enable() {
+	uint64_t *values = calloc(counter_count, sizeof(*values));
+	read_all(values);
+	for (int i = 0; i < counter_count; i++)
+		counters[i].start = values[i];
+	free(values);
+}
+
+static int sw_count() {
+	return counter_count;
+}
+
+static const char * sw_counter_name(int i) {
+	return counters[i].name;
+}
+
+static void sw_get_values(uint64_t *values) {
+	read_all(values);
+	for (int i = 0; i < counter_count; i++)
+		values[i] -= counters[i].start;
+}
+
+const struct counter_provider software_provider = {
+	.name = "sw",
+	.desc = "Unprivileged /proc/vmstat fields like vmstat/pgfault and rusage/<minflt|majflt|nvcsw|nivcsw|utime_us|...>.",
+	.parse = sw_parse,
+	.enable = sw_enable,
+	.count = sw_count,
+	.counter_name = sw_counter_name,
+	.get_values = sw_get_values,
+};
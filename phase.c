@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "phase.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool phase_parse_warmup(struct phase_config *config, const char *arg) {
+	char *end;
+	double value = strtod(arg, &end);
+	if (end == arg || value < 0) return false;
+	if (!strcmp(end, "c"))
+		config->warmup_commands = value;
+	else if (*end == '\0')
+		config->warmup_ns = value * 1e9;
+	else
+		return false;
+	return true;
+}
+
+bool phase_parse_steady(struct phase_config *config, const char *arg) {
+	char *s = strdup(arg);
+	char *cv = strtok(s, ":");
+	bool ok = cv != NULL;
+	config->cv = ok ? atof(cv) / 100 : 0;
+	config->window = 10;
+	for (char *part = strtok(NULL, ":"); ok && part; part = strtok(NULL, ":")) {
+		if (!strcmp(part, "stop"))
+			config->stop = true;
+		else
+			config->window = atoi(part);
+	}
+	ok = ok && config->cv > 0 && config->window >= 2;
+	free(s);
+	return ok;
+}
+
+void phase_print(const struct phase_config *config) {
+	if (config->warmup_ns > 0)
+		printf("Warm-up: %.1f s\n", config->warmup_ns / 1e9);
+	if (config->warmup_commands > 0)
+		printf("Warm-up: %"PRIu64" commands\n", config->warmup_commands);
+	if (config->cv > 0)
+		printf("Steady state: block rate CV below %.1f%% over %d intervals%s\n",
+				config->cv * 100, config->window, config->stop ? ", then stop" : "");
+}
+
+void phase_init(struct phase_tracker *t, const struct phase_config *config) {
+	memset(t, 0, sizeof(*t));
+	t->config = config;
+	t->phase = config->warmup_ns > 0 || config->warmup_commands > 0 ? PHASE_WARMUP : PHASE_MEASURE;
+	if (config->cv > 0)
+		t->rates = calloc(config->window, sizeof(*t->rates));
+}
+
+void phase_destroy(struct phase_tracker *t) {
+	free(t->rates);
+	t->rates = NULL;
+}
+
+bool phase_update(struct phase_tracker *t, uint64_t elapsed, uint64_t commands, double rate) {
+	const struct phase_config *c = t->config;
+	switch (t->phase) {
+	case PHASE_WARMUP:
+		if (elapsed < c->warmup_ns || commands < c->warmup_commands) return false;
+		t->phase = PHASE_MEASURE;
+		return true;
+	case PHASE_MEASURE:
+		if (c->cv == 0) return false;
+		t->rates[t->pos] = rate;
+		t->pos = (t->pos + 1) % c->window;
+		if (++t->count < c->window) return false;
+
+		double sum = 0, squares = 0;
+		for (int i = 0; i < c->window; i++)
+			sum += t->rates[i];
+		double mean = sum / c->window;
+		for (int i = 0; i < c->window; i++)
+			squares += (t->rates[i] - mean) * (t->rates[i] - mean);
+		if (mean <= 0) return false;
+		t->cv = sqrt(squares / (c->window - 1)) / mean;
+		if (t->cv >= c->cv) return false;
+		t->phase = PHASE_STEADY;
+		return true;
+	case PHASE_STEADY:
+		return false;
+	}
+	return false;
+}
+
+const char * phase_name(enum phase phase) {
+	switch (phase) {
+	case PHASE_WARMUP:  return "warmup";
+	case PHASE_MEASURE: return "measure";
+	case PHASE_STEADY:  return "steady";
+	}
+	return NULL;
+}
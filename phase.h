@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A run starts with a warm-up that isn't measured. Optionally, the
+// measurement is marked steady once throughput stops varying.
+enum phase {
+	PHASE_WARMUP,
+	PHASE_MEASURE,
+	PHASE_STEADY,
+};
+
+struct phase_config {
+	// Warm-up until both have been reached, 0 to skip.
+	uint64_t warmup_ns, warmup_commands;
+	// Steady when the coefficient of variation of the block rate over the
+	// last `window` intervals drops below `cv`, 0 to disable.
+	double cv;
+	int window;
+	// End the run once steady.
+	bool stop;
+};
+
+struct phase_tracker {
+	const struct phase_config *config;
+	enum phase phase;
+	// Ring buffer of the last block rates.
+	double *rates;
+	int count, pos;
+	// Coefficient of variation over the last full window.
+	double cv;
+};
+
+// Parses -w: <seconds> or <num>c for commands. Returns false on errors.
+bool phase_parse_warmup(struct phase_config *config, const char *arg);
+// Parses -S: <cv %>[:<intervals>][:stop]. Returns false on errors.
+bool phase_parse_steady(struct phase_config *config, const char *arg);
+// Prints the configuration to stdout.
+void phase_print(const struct phase_config *config);
+
+void phase_init(struct phase_tracker *t, const struct phase_config *config);
+void phase_destroy(struct phase_tracker *t);
+// Advances after an interval with the given block rate, `elapsed` ns and
+// `commands` since start. Returns true if the phase changed.
+bool phase_update(struct phase_tracker *t, uint64_t elapsed, uint64_t commands, double rate);
+const char * phase_name(enum phase phase);
@@ -18,9 +18,17 @@
 #include "pattern.h"
 #include <stdlib.h>
 #include <fcntl.h>
+#include <math.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
+
+static uint64_t seed;
+static uint64_t streams;
+
+static __thread struct rng thread_rng;
+static __thread bool thread_rng_ready;
 
 // Initializes the random number generator.
 void init_random() {
@@ -28,9 +36,7 @@ void init_random() {
 	// time will not use the same sequence.
 	int fd = open("/dev/urandom", O_RDONLY);
 	if (fd < 0) goto perror;
-	unsigned int seed;
 	if (read(fd, &seed, sizeof(seed)) != sizeof(seed)) goto perror;
-	srand(seed);
 	close(fd);
 	return;
 perror:
@@ -38,9 +44,123 @@ perror:
 	exit(1);
 }
 
-// Returns a random block number which allows accessing `size` blocks.
+static uint64_t splitmix64(uint64_t *x) {
+	uint64_t z = (*x += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+static void seed_stream(struct rng *rng, uint64_t stream) {
+	uint64_t x = seed ^ (stream * 0xd1b54a32d192ed03);
+	for (int i = 0; i < 4; i++)
+		rng->s[i] = splitmix64(&x);
+}
+
+void rng_init(struct rng *rng) {
+	seed_stream(rng, __atomic_fetch_add(&streams, 1, __ATOMIC_RELAXED));
+}
+
+void rng_seed(struct rng *rng, uint64_t stream) {
+	// Counted streams stay far below the top bit.
+	seed_stream(rng, stream | 1ull << 63);
+}
+
+uint64_t get_random_below(uint64_t n) {
+	if (!thread_rng_ready) {
+		rng_init(&thread_rng);
+		thread_rng_ready = true;
+	}
+	return rng_below(&thread_rng, n);
+}
+
 uint64_t get_random_block(uint64_t max, uint16_t size) {
-	// This isn't uniform, but hopefully random enough. It also won't use all
-	// of very large SSDs.
-	return rand() % (max - size);
+	return get_random_below(max - size);
+}
+
+bool block_dist_parse(struct block_dist *dist, const char *spec) {
+	if (!strcmp(spec, "uniform")) {
+		dist->kind = DIST_UNIFORM;
+	} else if (sscanf(spec, "zipf:%lf", &dist->theta) == 1) {
+		dist->kind = DIST_ZIPF;
+		if (!(dist->theta > 0 && dist->theta < 1)) return false;
+	} else if (sscanf(spec, "hotset:%lf:%lf", &dist->hot_access, &dist->hot_size) == 2) {
+		dist->kind = DIST_HOTSET;
+		dist->hot_access /= 100;
+		dist->hot_size /= 100;
+		if (dist->hot_access < 0 || dist->hot_access > 1 || dist->hot_size <= 0 || dist->hot_size > 1)
+			return false;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+void block_dist_print(const struct block_dist *dist) {
+	switch (dist->kind) {
+	case DIST_UNIFORM:
+		break;
+	case DIST_ZIPF:
+		printf("SSD block distribution: zipf with theta %g\n", dist->theta);
+		break;
+	case DIST_HOTSET:
+		printf("SSD block distribution: %g%% of accesses to %g%% of blocks\n", dist->hot_access * 100, dist->hot_size * 100);
+		break;
+	}
+	if (dist->granularity > 1)
+		printf("SSD block granularity: %"PRIu64" blocks\n", dist->granularity);
+}
+
+// Approximates the generalized harmonic number sum(i^-theta, i = 1..n): the
+// first terms are summed exactly, the rest is replaced by the integral, so
+// that this also works for 2^40 blocks.
+static double zeta(uint64_t n, double theta) {
+	const uint64_t exact = 10000;
+	double sum = 0;
+	for (uint64_t i = 1; i <= n && i <= exact; i++)
+		sum += pow(i, -theta);
+	if (n > exact)
+		sum += (pow(n + 0.5, 1 - theta) - pow(exact + 0.5, 1 - theta)) / (1 - theta);
+	return sum;
+}
+
+void block_dist_prepare(struct block_dist *dist, uint64_t max, uint16_t size) {
+	if (dist->granularity == 0) dist->granularity = 1;
+	dist->slots = max > size ? (max - size) / dist->granularity : 0;
+	if (dist->slots == 0) dist->slots = 1;
+	if (dist->kind == DIST_ZIPF) {
+		// Gray et al., "Quickly Generating Billion-Record Synthetic Databases".
+		dist->zeta_n = zeta(dist->slots, dist->theta);
+		dist->zeta_2 = zeta(2, dist->theta);
+		dist->alpha = 1 / (1 - dist->theta);
+		dist->eta = (1 - pow(2.0 / dist->slots, 1 - dist->theta)) / (1 - dist->zeta_2 / dist->zeta_n);
+	}
+}
+
+uint64_t block_dist_next(const struct block_dist *dist, struct rng *rng) {
+	uint64_t slot, hot;
+	double u;
+	switch (dist->kind) {
+	case DIST_ZIPF:
+		u = rng_double(rng);
+		if (u * dist->zeta_n < 1)
+			slot = 0;
+		else if (u * dist->zeta_n < 1 + pow(0.5, dist->theta))
+			slot = 1;
+		else
+			slot = dist->slots * pow(dist->eta * u - dist->eta + 1, dist->alpha);
+		slot = slot < dist->slots ? slot : dist->slots - 1;
+		break;
+	case DIST_HOTSET:
+		hot = dist->slots * dist->hot_size;
+		if (hot == 0) hot = 1;
+		if (hot >= dist->slots || rng_double(rng) < dist->hot_access)
+			slot = rng_below(rng, hot);
+		else
+			slot = hot + rng_below(rng, dist->slots - hot);
+		break;
+	default:
+		slot = rng_below(rng, dist->slots);
+	}
+	return slot * dist->granularity;
 }
@@ -14,7 +14,91 @@
  * limitations under the License.
  */
 
+#pragma once
+
 #include <inttypes.h>
+#include <stdbool.h>
+
+// xoshiro256** generator. Each thread uses its own instance, so there's no
+// shared state (and no lock as with rand()) in the hot path.
+struct rng {
+	uint64_t s[4];
+};
 
 void init_random();
+// Seeds `rng` with a new stream derived from the seed chosen by init_random().
+void rng_init(struct rng *rng);
+// Seeds `rng` with stream number `stream` of that seed, e.g. a worker index.
+// These never overlap with the streams from rng_init().
+void rng_seed(struct rng *rng, uint64_t stream);
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(struct rng *rng) {
+	uint64_t *s = rng->s;
+	uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rng_rotl(s[3], 45);
+	return result;
+}
+
+// Returns a uniformly distributed number in [0, n) without modulo bias
+// (Lemire's multiply-and-reject method).
+static inline uint64_t rng_below(struct rng *rng, uint64_t n) {
+	unsigned __int128 m = (unsigned __int128) rng_next(rng) * n;
+	uint64_t low = m;
+	if (low < n) {
+		uint64_t threshold = -n % n;
+		while (low < threshold) {
+			m = (unsigned __int128) rng_next(rng) * n;
+			low = m;
+		}
+	}
+	return m >> 64;
+}
+
+// Returns a uniformly distributed double in [0, 1).
+static inline double rng_double(struct rng *rng) {
+	return (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+// Returns a uniformly distributed block number which allows accessing `size`
+// more blocks, i.e. in [0, max - size). Uses a per-thread generator.
 uint64_t get_random_block(uint64_t max, uint16_t size);
+// Returns a uniformly distributed number in [0, n) from the per-thread generator.
+uint64_t get_random_below(uint64_t n);
+
+// Distribution of the SSD blocks commands access, set with -D and -B.
+struct block_dist {
+	enum {
+		DIST_UNIFORM,
+		// Zipf distribution with the lowest blocks being the most popular.
+		DIST_ZIPF,
+		// `hot_access` of the accesses go to the first `hot_size` of the range.
+		DIST_HOTSET,
+	} kind;
+	// Start blocks are multiples of this.
+	uint64_t granularity;
+	double theta;
+	double hot_access, hot_size;
+
+	// Set up by block_dist_prepare() for a range of `slots` start blocks.
+	uint64_t slots;
+	double zeta_n, zeta_2, alpha, eta;
+};
+
+// Parses "uniform", "zipf:<theta>" with 0 < theta < 1 or
+// "hotset:<access %>:<size %>". Returns false on errors.
+bool block_dist_parse(struct block_dist *dist, const char *spec);
+void block_dist_print(const struct block_dist *dist);
+// Precomputes the distribution for a device with `max` blocks and commands
+// of up to `size` more blocks.
+void block_dist_prepare(struct block_dist *dist, uint64_t max, uint16_t size);
+uint64_t block_dist_next(const struct block_dist *dist, struct rng *rng);
@@ -0,0 +1,195 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "backend.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+
+// A simulated SSD in memory. Commands complete after a fixed latency once the
+// device has transferred their data at the configured bandwidth.
+struct sim_device {
+	struct ssd_features features;
+	uint64_t latency_ns;
+	// 0 if bandwidth is unlimited.
+	double ns_per_byte;
+	// Actually copy data from/to the buffer to cause memory traffic.
+	bool copy;
+	// Time at which the simulated link is free again, shared by all queues.
+	uint64_t busy_until;
+};
+
+struct sim_pending {
+	uint64_t due;
+	uint64_t user_data;
+};
+
+struct sim_queue {
+	struct sim_device *dev;
+	// As all commands have the same latency, they complete in order.
+	unsigned size, head, count;
+	struct sim_pending *pending;
+	uint8_t *scratch;
+};
+
+enum {
+	SIM_SIZE,
+	SIM_LATENCY,
+	SIM_BANDWIDTH,
+	SIM_BLOCK_SIZE,
+	SIM_MDTS,
+	SIM_COPY,
+};
+
+static char *const sim_tokens[] = {
+	[SIM_SIZE] = "size",
+	[SIM_LATENCY] = "lat",
+	[SIM_BANDWIDTH] = "bw",
+	[SIM_BLOCK_SIZE] = "bs",
+	[SIM_MDTS] = "mdts",
+	[SIM_COPY] = "copy",
+	NULL
+};
+
+static void sim_usage() {
+	fprintf(stderr, "Simulated device options (comma-separated):\n");
+	fprintf(stderr, "\tsize=<GiB>\tDevice size (default 256).\n");
+	fprintf(stderr, "\tlat=<us>\tCommand latency (default 80).\n");
+	fprintf(stderr, "\tbw=<MiB/s>\tTransfer bandwidth, 0 for unlimited (default 3000).\n");
+	fprintf(stderr, "\tbs=<B>\t\tBlock size (default 512).\n");
+	fprintf(stderr, "\tmdts=<KiB>\tMaximum transfer size (default 128).\n");
+	fprintf(stderr, "\tcopy\t\tCopy data from/to the buffer.\n");
+	exit(1);
+}
+
+static void * sim_open(const char *path, const char *options) {
+	struct sim_device *dev = calloc(1, sizeof(*dev));
+	uint64_t size = 256, bandwidth = 3000, block_size = 512, mdts = 128;
+	dev->latency_ns = 80000;
+
+	char *opts = strdup(options ? options : ""), *p = opts, *value;
+	while (*p != '\0') {
+		int token = getsubopt(&p, sim_tokens, &value);
+		if (token != SIM_COPY && value == NULL) sim_usage();
+		switch (token) {
+		case SIM_SIZE:       size = atoll(value); break;
+		case SIM_LATENCY:    dev->latency_ns = atoll(value) * 1000; break;
+		case SIM_BANDWIDTH:  bandwidth = atoll(value); break;
+		case SIM_BLOCK_SIZE: block_size = atoll(value); break;
+		case SIM_MDTS:       mdts = atoll(value); break;
+		case SIM_COPY:       dev->copy = true; break;
+		default:             sim_usage();
+		}
+	}
+	free(opts);
+	if (block_size < 512 || (block_size & (block_size - 1)) || (mdts << 10) < block_size) sim_usage();
+
+	struct ssd_features *f = &dev->features;
+	snprintf(f->sn, sizeof(f->sn), "%s", path);
+	snprintf(f->mn, sizeof(f->mn), "Simulated SSD");
+	f->lba_shift = __builtin_ctzll(block_size);
+	f->size = (size << 30) >> f->lba_shift;
+	f->max_block_count = (mdts << 10) >> f->lba_shift;
+	dev->ns_per_byte = bandwidth ? 1e9 / (bandwidth << 20) : 0;
+	return dev;
+}
+
+static void sim_identify(void *dev, struct ssd_features *features) {
+	*features = ((struct sim_device *) dev)->features;
+}
+
+static void * sim_create_queue(void *dev, unsigned depth) {
+	struct sim_queue *queue = calloc(1, sizeof(*queue));
+	queue->dev = dev;
+	queue->size = depth;
+	queue->pending = calloc(depth, sizeof(*queue->pending));
+	if (queue->dev->copy)
+		queue->scratch = malloc((queue->dev->features.max_block_count + 1) << queue->dev->features.lba_shift);
+	return queue;
+}
+
+static void sim_destroy_queue(void *_queue) {
+	struct sim_queue *queue = _queue;
+	free(queue->pending);
+	free(queue->scratch);
+	free(queue);
+}
+
+// Reserves the simulated link for `bytes` and returns the time the transfer finishes.
+static uint64_t sim_transfer(struct sim_device *dev, size_t bytes) {
+	uint64_t now = now_ns();
+	uint64_t duration = bytes * dev->ns_per_byte;
+	uint64_t busy = __atomic_load_n(&dev->busy_until, __ATOMIC_RELAXED), end;
+	do {
+		end = MAX(busy, now) + duration;
+	} while (!__atomic_compare_exchange_n(&dev->busy_until, &busy, end, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return end;
+}
+
+static void sim_submit(void *_queue, const struct io_request *req) {
+	struct sim_queue *queue = _queue;
+	struct sim_device *dev = queue->dev;
+	if (queue->count == queue->size) {
+		fprintf(stderr, "Too many commands in flight.\n");
+		exit(1);
+	}
+	size_t bytes = req->op == OP_FLUSH ? 0 : (req->block_count + 1) << dev->features.lba_shift;
+	if (dev->copy) {
+		// Operations are from memory perspective.
+		if (req->op == OP_READ)
+			memcpy(queue->scratch, req->buffer, bytes);
+		else if (req->op == OP_WRITE)
+			memcpy(req->buffer, queue->scratch, bytes);
+	}
+
+	struct sim_pending *p = &queue->pending[(queue->head + queue->count++) % queue->size];
+	p->due = sim_transfer(dev, bytes) + dev->latency_ns;
+	p->user_data = req->user_data;
+}
+
+static void sim_flush(void *queue) {
+}
+
+static unsigned sim_poll(void *_queue, uint64_t *user_data, unsigned min, unsigned max) {
+	struct sim_queue *queue = _queue;
+	min = MIN(min, queue->count);
+	if (min > 0)
+		wait_until_ns(queue->pending[(queue->head + min - 1) % queue->size].due);
+
+	uint64_t now = now_ns();
+	unsigned n = 0;
+	while (n < max && queue->count > 0 && queue->pending[queue->head].due <= now) {
+		user_data[n++] = queue->pending[queue->head].user_data;
+		queue->head = (queue->head + 1) % queue->size;
+		queue->count--;
+	}
+	return n;
+}
+
+const struct io_backend sim_backend = {
+	.name = "sim",
+	.desc = "Simulated SSD in memory, see -e sim:help.",
+	.open = sim_open,
+	.identify = sim_identify,
+	.create_queue = sim_create_queue,
+	.destroy_queue = sim_destroy_queue,
+	.submit = sim_submit,
+	.flush = sim_flush,
+	.poll = sim_poll,
+};
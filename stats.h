@@ -0,0 +1,77 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_LINE_SIZE 64
+
+// Throughput counters. They only ever increase, the reporter computes
+// deltas between snapshots instead of resetting them.
+struct counters {
+	uint64_t blocks;
+	uint64_t commands;
+};
+
+// Operations are also counted separately, indexed by OP_*.
+#define STATS_OPS 3
+
+// Each worker owns one slot on its own cache line so that the workers'
+// increments don't bounce lines between cores. Single writer, any readers.
+struct worker_stats {
+	struct counters total;
+	struct counters ops[STATS_OPS];
+	// Queueing delay of the last command in ns.
+	uint64_t lag;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static inline struct worker_stats *stats_alloc(int workers) {
+	size_t size = workers * sizeof(struct worker_stats);
+	struct worker_stats *stats = aligned_alloc(CACHE_LINE_SIZE, size);
+	memset(stats, 0, size);
+	return stats;
+}
+
+// Only the owning worker writes its padded slot, so a relaxed read-modify-write
+// is enough. The reporter may see blocks and commands from slightly different
+// moments, which evens out over the next interval.
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_set(uint64_t *value, uint64_t n) {
+	__atomic_store_n(value, n, __ATOMIC_RELAXED);
+}
+
+// Takes a snapshot of counters of a worker.
+static inline struct counters counters_load(const struct counters *c) {
+	return (struct counters) {
+		__atomic_load_n(&c->blocks, __ATOMIC_RELAXED),
+		__atomic_load_n(&c->commands, __ATOMIC_RELAXED),
+	};
+}
+
+static inline void counters_add(struct counters *a, struct counters b) {
+	a->blocks += b.blocks;
+	a->commands += b.commands;
+}
+
+static inline struct counters counters_sub(struct counters a, struct counters b) {
+	return (struct counters) { a.blocks - b.blocks, a.commands - b.commands };
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For asprintf.
+#define _GNU_SOURCE
+
+#include "sweep.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char * const param_names[SWEEP_PARAMS] = {
+	[SWEEP_THREADS] = "j",
+	[SWEEP_QUEUE_DEPTH] = "q",
+	[SWEEP_BLOCK_LIMIT] = "l",
+	[SWEEP_COMMAND_LIMIT] = "L",
+	[SWEEP_BUFFER] = "b",
+	[SWEEP_TRANSFER_SIZE] = "s",
+};
+
+const char * sweep_param_name(enum sweep_param param) {
+	return param_names[param];
+}
+
+void sweep_usage() {
+	fprintf(stderr, "\t\tj (threads), q (queue depth), l (blocks/s), L (commands/s),\n");
+	fprintf(stderr, "\t\tb (pattern buffer in blocks) or s (pattern transfer size in blocks or K/M/G bytes).\n");
+}
+
+// Parses a number with an optional K/M/G suffix, which is kept for output.
+static bool parse_value(const char *s, uint64_t *value, int *shift) {
+	char *end;
+	*value = strtoull(s, &end, 10);
+	*shift = 0;
+	switch (*end) {
+	case 'G': case 'g': *shift = 30; break;
+	case 'M': case 'm': *shift = 20; break;
+	case 'K': case 'k': *shift = 10; break;
+	}
+	if (*shift) end++;
+	*value <<= *shift;
+	return end != s && *end == '\0';
+}
+
+static void add_string(struct sweep_axis *axis, char *s) {
+	axis->values = realloc(axis->values, (axis->count + 1) * sizeof(*axis->values));
+	axis->values[axis->count++] = s;
+}
+
+static void add_value(struct sweep_axis *axis, uint64_t value, int shift) {
+	static const char suffixes[] = { [10] = 'K', [20] = 'M', [30] = 'G' };
+	char *s;
+	// Keep the suffix if possible as the pattern's -s treats it as bytes.
+	while (shift > 0 && value & ((1ull << shift) - 1)) shift -= 10;
+	if (shift > 0)
+		asprintf(&s, "%"PRIu64"%c", value >> shift, suffixes[shift]);
+	else
+		asprintf(&s, "%"PRIu64, value);
+	add_string(axis, s);
+}
+
+// Expands <from>..<to>[*<factor>|+<step>], doubling by default.
+static bool parse_range(struct sweep_axis *axis, char *range) {
+	char *to = strstr(range, "..");
+	*to = '\0';
+	to += 2;
+	uint64_t factor = 2, step = 0;
+	char *op = strpbrk(to, "*+");
+	if (op) {
+		if (*op == '*') factor = atoll(op + 1);
+		else step = atoll(op + 1);
+		*op = '\0';
+	}
+	uint64_t from_value, to_value;
+	int from_shift, to_shift;
+	if (!parse_value(range, &from_value, &from_shift) || !parse_value(to, &to_value, &to_shift))
+		return false;
+	if (from_value > to_value || (step == 0 && (factor < 2 || from_value == 0)))
+		return false;
+	// Keep the larger suffix of both ends.
+	int shift = from_shift > to_shift ? from_shift : to_shift;
+	for (uint64_t v = from_value; v <= to_value; v = step ? v + step : v * factor)
+		add_value(axis, v, shift);
+	return true;
+}
+
+bool sweep_parse(struct sweep *s, const char *arg) {
+	char *copy = strdup(arg), *save;
+	char *values = strchr(copy, '=');
+	bool ok = values != NULL;
+	if (!ok) goto out;
+	*values++ = '\0';
+
+	ok = false;
+	for (int p = 0; p < SWEEP_PARAMS; p++) {
+		if (!strcmp(copy, param_names[p]) && sweep_axis(s, p) == NULL) {
+			s->axes[s->axis_count].param = p;
+			ok = true;
+		}
+	}
+	if (!ok) goto out;
+
+	struct sweep_axis *axis = &s->axes[s->axis_count];
+	axis->values = NULL;
+	axis->count = 0;
+	for (char *v = strtok_r(values, ",", &save); ok && v; v = strtok_r(NULL, ",", &save)) {
+		if (strstr(v, ".."))
+			ok = parse_range(axis, v);
+		else
+			add_string(axis, strdup(v));
+	}
+	ok = ok && axis->count > 0;
+	// The pattern's -b only takes a number of blocks.
+	for (int i = 0; ok && axis->param == SWEEP_BUFFER && i < axis->count; i++)
+		ok = axis->values[i][strspn(axis->values[i], "0123456789")] == '\0';
+	if (ok) s->axis_count++;
+out:
+	free(copy);
+	return ok;
+}
+
+const struct sweep_axis * sweep_axis(const struct sweep *s, enum sweep_param param) {
+	for (int i = 0; i < s->axis_count; i++)
+		if (s->axes[i].param == param) return &s->axes[i];
+	return NULL;
+}
+
+int sweep_points(const struct sweep *s) {
+	int points = 1;
+	for (int i = 0; i < s->axis_count; i++)
+		points *= s->axes[i].count;
+	return points;
+}
+
+void sweep_point(const struct sweep *s, int index, const char **values) {
+	for (int i = s->axis_count - 1; i >= 0; i--) {
+		values[i] = s->axes[i].values[index % s->axes[i].count];
+		index /= s->axes[i].count;
+	}
+}
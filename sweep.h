@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Runs the benchmark once for every combination of parameter values.
+enum sweep_param {
+	SWEEP_THREADS,
+	SWEEP_QUEUE_DEPTH,
+	SWEEP_BLOCK_LIMIT,
+	SWEEP_COMMAND_LIMIT,
+	// Pattern options -b and -s.
+	SWEEP_BUFFER,
+	SWEEP_TRANSFER_SIZE,
+	SWEEP_PARAMS,
+};
+
+struct sweep_axis {
+	enum sweep_param param;
+	// Values as given or expanded from ranges, converted by the user.
+	char **values;
+	int count;
+};
+
+struct sweep {
+	struct sweep_axis axes[SWEEP_PARAMS];
+	int axis_count;
+};
+
+// Parses -X: <name>=<values> with comma-separated values or ranges
+// <from>..<to>[*<factor>|+<step>]. Returns false on errors.
+bool sweep_parse(struct sweep *s, const char *arg);
+// Returns the axis of `param` or NULL.
+const struct sweep_axis * sweep_axis(const struct sweep *s, enum sweep_param param);
+// Number of points, 1 without axes.
+int sweep_points(const struct sweep *s);
+// Stores the value of each axis at point `index`. The first axis changes slowest.
+void sweep_point(const struct sweep *s, int index, const char **values);
+const char * sweep_param_name(enum sweep_param param);
+// Prints the usage of -X to stderr.
+void sweep_usage();
@@ -0,0 +1,50 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+// Returns the current value of the monotonic clock in nanoseconds.
+static inline uint64_t now_ns() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Sleeps until the monotonic clock reaches `ns`.
+static inline void sleep_until_ns(uint64_t ns) {
+	struct timespec t = { .tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull };
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0);
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+// Waits until the monotonic clock reaches `ns`. Sleeping overshoots by the
+// timer slack (50 us by default), so the last part is spent spinning.
+#define SPIN_NS 60000
+static inline void wait_until_ns(uint64_t ns) {
+	uint64_t now = now_ns();
+	if (ns > now + SPIN_NS)
+		sleep_until_ns(ns - SPIN_NS);
+	while (now_ns() < ns)
+		cpu_relax();
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static FILE *trace_file;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void trace_open(const char *path, uint64_t buffer_blocks) {
+	struct trace_header header = {
+		.version = TRACE_VERSION,
+		.record_size = sizeof(struct trace_record),
+		.buffer_blocks = buffer_blocks,
+	};
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+
+	trace_file = fopen(path, "w+b");
+	if (trace_file == NULL || fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+		perror(path);
+		exit(1);
+	}
+}
+
+void trace_add(struct trace_buffer *buffer, const struct cmd *cmd, uint64_t time) {
+	buffer->records[buffer->count++] = (struct trace_record) {
+		.time = time,
+		.target_block = cmd->target_block,
+		.block_count = cmd->block_count,
+		.op = cmd->op,
+	};
+	if (buffer->count == TRACE_BUFFER_SIZE)
+		trace_flush(buffer);
+}
+
+void trace_flush(struct trace_buffer *buffer) {
+	pthread_mutex_lock(&trace_mutex);
+	if (fwrite(buffer->records, sizeof(buffer->records[0]), buffer->count, trace_file) != buffer->count) {
+		perror("trace");
+		exit(1);
+	}
+	fflush(trace_file);
+	pthread_mutex_unlock(&trace_mutex);
+	buffer->count = 0;
+}
+
+static int compare_records(const void *_a, const void *_b) {
+	const struct trace_record *a = _a, *b = _b;
+	return (a->time > b->time) - (a->time < b->time);
+}
+
+void trace_close() {
+	pthread_mutex_lock(&trace_mutex);
+	long size = ftell(trace_file);
+	uint8_t *trace = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(trace_file), 0);
+	if (trace == MAP_FAILED) {
+		perror("trace");
+		exit(1);
+	}
+	size_t count = (size - sizeof(struct trace_header)) / sizeof(struct trace_record);
+	qsort(trace + sizeof(struct trace_header), count, sizeof(struct trace_record), compare_records);
+	munmap(trace, size);
+	fclose(trace_file);
+	trace_file = NULL;
+	pthread_mutex_unlock(&trace_mutex);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "pattern.h"
+
+// Binary command trace as written by -R and read by the replay pattern: a
+// header followed by fixed-size records.
+#define TRACE_MAGIC "NVMEMTRC"
+#define TRACE_VERSION 1
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	// Size of the memory buffer the trace was recorded with.
+	uint64_t buffer_blocks;
+};
+
+struct trace_record {
+	// Submission time in ns since the start.
+	uint64_t time;
+	uint64_t target_block;
+	uint16_t block_count;
+	uint8_t op;
+	uint8_t reserved[5];
+};
+
+// Per-thread buffer for recording commands.
+#define TRACE_BUFFER_SIZE 4096
+struct trace_buffer {
+	unsigned count;
+	struct trace_record records[TRACE_BUFFER_SIZE];
+};
+
+// Creates the trace file. Exits on errors.
+void trace_open(const char *path, uint64_t buffer_blocks);
+// Appends a command, writing the buffer to the file when it's full.
+void trace_add(struct trace_buffer *buffer, const struct cmd *cmd, uint64_t time);
+// Writes out the buffered commands.
+void trace_flush(struct trace_buffer *buffer);
+// Finishes the trace after all buffers have been flushed. As every thread
+// writes its own chunks, this sorts the records by time for replaying.
+void trace_close();
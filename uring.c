@@ -0,0 +1,285 @@
+/*
+ * Copyright © 2015 Lukas Werling
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// For O_DIRECT.
+#define _GNU_SOURCE
+
+#include "backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include "linux/nvme.h" // Local header with additions.
+#include "nvme.h"
+
+struct uring_device {
+	enum {
+		URING_PASSTHROUGH,
+		URING_READWRITE,
+	} mode;
+	int fd;
+	uint32_t nsid;
+	int lba_shift;
+};
+
+// We talk to the kernel directly instead of depending on liburing.
+struct uring {
+	struct uring_device *dev;
+	int fd;
+	// Passthrough rings use 128 byte SQEs and 32 byte CQEs.
+	unsigned sqe_shift, cqe_shift;
+	unsigned to_submit;
+
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	void *sqes;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	void *cqes;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+};
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// Checks whether the kernel knows IORING_OP_URING_CMD.
+static bool has_uring_cmd() {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int ring = io_uring_setup(1, &p);
+	if (ring < 0) return false;
+
+	size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, len);
+	bool result = false;
+	if (io_uring_register(ring, IORING_REGISTER_PROBE, probe, 256) == 0)
+		result = probe->last_op >= IORING_OP_URING_CMD &&
+			(probe->ops[IORING_OP_URING_CMD].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	close(ring);
+	return result;
+}
+
+// Uses NVMe passthrough on NVMe character devices if the kernel supports it
+// and plain reads/writes on block devices and regular files otherwise.
+static void * uring_open(const char *path, const char *options) {
+	struct uring_device *dev = calloc(1, sizeof(*dev));
+	struct stat st;
+	if (stat(path, &st) == 0 && S_ISCHR(st.st_mode)) {
+		dev->fd = open(path, O_RDONLY);
+		if (dev->fd >= 0 && (dev->nsid = nvme_get_nsid(dev->fd)) != (uint32_t) -1 && has_uring_cmd()) {
+			dev->mode = URING_PASSTHROUGH;
+			fprintf(stderr, "Using io_uring NVMe passthrough.\n");
+			return dev;
+		}
+		if (dev->fd >= 0) close(dev->fd);
+	}
+
+	dev->mode = URING_READWRITE;
+	dev->fd = backend_open_direct(path);
+	return dev;
+}
+
+static void uring_identify(void *_dev, struct ssd_features *features) {
+	struct uring_device *dev = _dev;
+	if (dev->mode == URING_PASSTHROUGH) {
+		if (nvme_get_features(dev->fd, dev->nsid, features) != 0) exit(1);
+	} else {
+		backend_generic_identify(dev->fd, features);
+	}
+	dev->lba_shift = features->lba_shift;
+}
+
+static void * uring_create_queue(void *dev, unsigned depth) {
+	struct uring *ring = calloc(1, sizeof(*ring));
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ring->dev = dev;
+	ring->sqe_shift = 0;
+	ring->cqe_shift = 0;
+	if (ring->dev->mode == URING_PASSTHROUGH) {
+		p.flags = IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
+		ring->sqe_shift = 1;
+		ring->cqe_shift = 1;
+	}
+	ring->fd = io_uring_setup(depth, &p);
+	if (ring->fd < 0) goto perror;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe) << ring->cqe_shift);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_len = ring->cq_len = MAX(ring->sq_len, ring->cq_len);
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) goto perror;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) goto perror;
+	}
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe) << ring->sqe_shift;
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) goto perror;
+
+	ring->sq_head  = ring->sq_ptr + p.sq_off.head;
+	ring->sq_tail  = ring->sq_ptr + p.sq_off.tail;
+	ring->sq_mask  = ring->sq_ptr + p.sq_off.ring_mask;
+	ring->sq_array = ring->sq_ptr + p.sq_off.array;
+	ring->cq_head  = ring->cq_ptr + p.cq_off.head;
+	ring->cq_tail  = ring->cq_ptr + p.cq_off.tail;
+	ring->cq_mask  = ring->cq_ptr + p.cq_off.ring_mask;
+	ring->cqes     = ring->cq_ptr + p.cq_off.cqes;
+	return ring;
+perror:
+	perror("io_uring");
+	exit(1);
+}
+
+static void uring_destroy_queue(void *_ring) {
+	struct uring *ring = _ring;
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_len);
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+	free(ring);
+}
+
+static void prep_passthrough(struct uring_device *dev, struct io_uring_sqe *sqe, const struct io_request *req) {
+	struct nvme_uring_cmd *cmd = (struct nvme_uring_cmd *) sqe->cmd;
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = dev->fd;
+	sqe->cmd_op = NVME_URING_CMD_IO;
+	cmd->opcode = req->op;
+	cmd->nsid = dev->nsid;
+	if (req->op != OP_FLUSH) {
+		cmd->addr = (__u64) req->buffer;
+		// Like nvme_user_io, the block count is 0-based.
+		cmd->data_len = (req->block_count + 1) << dev->lba_shift;
+		cmd->cdw10 = req->start_block & 0xffffffff;
+		cmd->cdw11 = req->start_block >> 32;
+		cmd->cdw12 = req->block_count;
+	}
+}
+
+static void prep_readwrite(struct uring_device *dev, struct io_uring_sqe *sqe, const struct io_request *req) {
+	sqe->fd = dev->fd;
+	switch (req->op) {
+	case OP_FLUSH:
+		sqe->opcode = IORING_OP_FSYNC;
+		return;
+	// Operations are from memory perspective, so reading memory means
+	// writing to the device.
+	case OP_READ:
+		sqe->opcode = IORING_OP_WRITE;
+		break;
+	case OP_WRITE:
+		sqe->opcode = IORING_OP_READ;
+		break;
+	}
+	sqe->addr = (__u64) req->buffer;
+	// Transfer the same amount of data as the 0-based NVMe commands.
+	sqe->len = (req->block_count + 1) << dev->lba_shift;
+	sqe->off = req->start_block << dev->lba_shift;
+}
+
+static void uring_submit(void *_ring, const struct io_request *req) {
+	struct uring *ring = _ring;
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + (index * sizeof(struct io_uring_sqe) << ring->sqe_shift);
+	memset(sqe, 0, sizeof(*sqe) << ring->sqe_shift);
+	if (ring->dev->mode == URING_PASSTHROUGH)
+		prep_passthrough(ring->dev, sqe, req);
+	else
+		prep_readwrite(ring->dev, sqe, req);
+	sqe->user_data = req->user_data;
+	ring->sq_array[index] = index;
+	store_release(ring->sq_tail, tail + 1);
+	ring->to_submit++;
+}
+
+// Submits all queued commands and waits for at least `min_complete` completions.
+static void uring_enter(struct uring *ring, unsigned min_complete) {
+	unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+	if (ring->to_submit == 0 && min_complete == 0) return;
+	do {
+		ret = io_uring_enter(ring->fd, ring->to_submit, min_complete, flags);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		perror("io_uring_enter");
+		exit(1);
+	}
+	ring->to_submit -= ret;
+}
+
+static void uring_flush(void *ring) {
+	uring_enter(ring, 0);
+}
+
+static unsigned uring_poll(void *_ring, uint64_t *user_data, unsigned min, unsigned max) {
+	struct uring *ring = _ring;
+	uring_enter(ring, min);
+	unsigned head = *ring->cq_head;
+	unsigned tail = load_acquire(ring->cq_tail);
+	unsigned n = 0;
+	for (; head != tail && n < max; head++, n++) {
+		struct io_uring_cqe *cqe = ring->cqes + ((head & *ring->cq_mask) * sizeof(struct io_uring_cqe) << ring->cqe_shift);
+		if (cqe->res < 0) {
+			fprintf(stderr, "io_uring: %s\n", strerror(-cqe->res));
+			exit(1);
+		} else if (ring->dev->mode == URING_PASSTHROUGH && cqe->res > 0) {
+			fprintf(stderr, "io_uring: NVMe status %04x\n", cqe->res);
+			exit(1);
+		}
+		user_data[n] = cqe->user_data;
+	}
+	store_release(ring->cq_head, head);
+	return n;
+}
+
+const struct io_backend uring_backend = {
+	.name = "uring",
+	.desc = "io_uring with NVMe passthrough or reads/writes (default with -q).",
+	.open = uring_open,
+	.identify = uring_identify,
+	.create_queue = uring_create_queue,
+	.destroy_queue = uring_destroy_queue,
+	.submit = uring_submit,
+	.flush = uring_flush,
+	.poll = uring_poll,
+};